@@ -1,8 +1,11 @@
 #version 450 core
 
+// The chunk's BlockStorage: each block is an index into the palette, packed in z-order.
 layout(std430, binding = 3) buffer someLayoutName
 {
-	uvec4 blockData[64 * 64 * 64 / 16];
+	uint bits; // width of each index, 0 for a chunk of one type
+	uint palette[256 / 4]; // block types, 4 to a uint
+	uint indices[];
 };
 
 in flat uint dir;
@@ -38,14 +41,15 @@ void main()
 	uint z = uint(floor(voxelCoord.z + voxelOffset.z));
 	uint m = getMortonCode(x, y, z);
 
-	uint bytePosition = m % 4;
-	uint uintPosition = (m / 4) % 4;
-	uint vecIndex = m / 16;
-	uint bytes = blockData[vecIndex][uintPosition];
+	// the widths divide 32, so an index never spans two uints
+	uint index = 0;
+	if (bits != 0)
+	{
+		uint bit = m * bits;
+		index = (indices[bit / 32] >> (bit % 32)) & ((1u << bits) - 1);
+	}
 
-	// (4 - bytePosition) for little-endian
-	// I don't know why this is big-endian
-	uint blockType = (bytes >> (bytePosition * 8)) & 0xFF;
+	uint blockType = (palette[index / 4] >> ((index % 4) * 8)) & 0xFF;
 	vec3 blockCoord = vec3(voxelCoord.x - float(x), voxelCoord.y - float(y), voxelCoord.z - float(z));
 	vec2 textureCoord;
 
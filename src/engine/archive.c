@@ -0,0 +1,841 @@
+// Archives pack the region files of many L3 regions into one file, instead of a directory per L3 region.
+//
+// An archive starts with a header and an index with one entry per region and LOD level, followed by the region files.
+// Regions coarser than L3 hold one chunk, so an archive has room for 8 L4 regions and one region of each coarser level,
+// which is stored in the archive at its base coords.
+// Space is handed out in pages. A region that is written again gets new pages, and the index entry is only switched
+// to them once they are on disk, so a crash leaves either the old or the new version. Replaced pages are reused once no
+// read can still be using them, and an archive that ends up mostly free is compacted into a new file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "SDL2/SDL.h"
+#include "archive.h"
+#include "compress.h"
+#include "filesystem.h"
+#include "utility.h"
+
+enum
+{
+	ARCHIVE_MAGIC = 0x52415346, // "FSAR" in little-endian byte order
+	ARCHIVE_VERSION = 1,
+	ARCHIVE_SIDE = 4, // L3 regions along each side of an archive
+	ARCHIVE_REGION_SLOTS = ARCHIVE_SIDE * ARCHIVE_SIDE * ARCHIVE_SIDE * (REGION_LOD_LEVEL + 1), // one per L3 region and LOD level
+	ARCHIVE_NUM_SLOTS = ARCHIVE_REGION_SLOTS + 8 + (LOD_MAX_LEVELS - REGION_LOD_LEVEL - 2), // and the coarser regions
+	ARCHIVE_INDEX_START = 512, // the index starts on its own sector
+	ARCHIVE_PAGE_SIZE = 4096,
+	ARCHIVE_DATA_PAGE = 3, // first page after the header and index
+	ARCHIVE_COMPACT_MIN = 4 * 1024 * 1024, // free bytes an archive can have before it is compacted
+	ARCHIVE_CONVERT_BATCH = 64, // region files converted per write, which syncs once
+};
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t numSlots;
+	uint32_t reserved[6];
+} ArchiveHeader;
+
+// Entries take 32 bytes, so that no sector holds part of one, and rewriting an entry can't tear it.
+typedef struct
+{
+	uint64_t offset; // a multiple of ARCHIVE_PAGE_SIZE
+	uint32_t size; // bytes of region file data, 0 for an empty slot
+	uint32_t numPages; // pages reserved at offset
+	uint32_t reserved[3];
+	uint32_t checksum; // CRC32C of the fields above
+} ArchiveEntry;
+
+typedef struct
+{
+	char path[PATH_FULLMAXLEN];
+	bool exists; // the file has been created
+	int numSlots; // entries in the file's index. Older archives have no slots for regions coarser than L3.
+	ArchiveEntry entries[ARCHIVE_NUM_SLOTS];
+	ListUInt64 freePages; // free extents as firstPage << 32 | numPages, sorted
+	ListUInt64 retiredPages; // extents of replaced data, which reads may still be using
+	uint32_t numPages; // size of the file in pages
+	uint32_t numUsedPages; // pages held by entries
+	int numReaders; // reads between Archive_BeginRead and Archive_EndRead
+} Archive;
+
+struct ArchiveSet
+{
+	char *folderPath;
+	SDL_mutex *mutex;
+	HashMapUInt64 archives; // Archive pointers by archive coords
+	ListUInt64 allArchives;
+};
+
+static inline int FloorDiv(int a, int b)
+{
+	return (a >= 0 ? a : a - b + 1) / b;
+}
+
+// Finds the archive of a region and its slot in the index. baseCoords are L0 chunk coords aligned to the region's width.
+static int GetSlot(ivec3 baseCoords, int lodLevel, ivec3 archiveCoords)
+{
+	int local[3];
+
+	for (int a = 0; a < 3; a++)
+	{
+		int l3 = FloorDiv(baseCoords[a], 8);
+		archiveCoords[a] = FloorDiv(l3, ARCHIVE_SIDE);
+		local[a] = l3 - (archiveCoords[a] * ARCHIVE_SIDE);
+	}
+
+	if (lodLevel <= REGION_LOD_LEVEL)
+		return ((((local[2] * ARCHIVE_SIDE) + local[1]) * ARCHIVE_SIDE + local[0]) * (REGION_LOD_LEVEL + 1)) + lodLevel;
+
+	// an L4 region is two L3 regions wide
+	if (lodLevel == REGION_LOD_LEVEL + 1)
+		return ARCHIVE_REGION_SLOTS + ((((local[2] / 2) * 2) + (local[1] / 2)) * 2) + (local[0] / 2);
+
+	return ARCHIVE_REGION_SLOTS + 8 + (lodLevel - REGION_LOD_LEVEL - 2);
+}
+
+// The reverse of GetSlot: finds the region that a slot of the archive at archiveCoords holds, and returns its LOD level.
+static int SlotRegion(int slot, ivec3 archiveCoords, ivec3 baseCoords)
+{
+	int local[3] = { 0, 0, 0 };
+	int lodLevel;
+
+	if (slot < ARCHIVE_REGION_SLOTS)
+	{
+		int l3 = slot / (REGION_LOD_LEVEL + 1);
+		local[0] = l3 % ARCHIVE_SIDE;
+		local[1] = (l3 / ARCHIVE_SIDE) % ARCHIVE_SIDE;
+		local[2] = l3 / (ARCHIVE_SIDE * ARCHIVE_SIDE);
+		lodLevel = slot % (REGION_LOD_LEVEL + 1);
+	}
+	else if (slot < ARCHIVE_REGION_SLOTS + 8)
+	{
+		int l4 = slot - ARCHIVE_REGION_SLOTS;
+		local[0] = (l4 % 2) * 2;
+		local[1] = ((l4 / 2) % 2) * 2;
+		local[2] = (l4 / 4) * 2;
+		lodLevel = REGION_LOD_LEVEL + 1;
+	}
+	else
+	{
+		lodLevel = slot - ARCHIVE_REGION_SLOTS - 8 + REGION_LOD_LEVEL + 2;
+	}
+
+	for (int a = 0; a < 3; a++)
+		baseCoords[a] = ((archiveCoords[a] * ARCHIVE_SIDE) + local[a]) * 8;
+
+	return lodLevel;
+}
+
+static inline uint64_t ArchiveKey(ivec3 archiveCoords)
+{
+	const uint64_t mask = 0xfffff;
+
+	// the top bit keeps the key from being 0, which the hash map reserves
+	return (1ull << 63)
+		| (((uint64_t)archiveCoords[2] & mask) << 40)
+		| (((uint64_t)archiveCoords[1] & mask) << 20)
+		| ((uint64_t)archiveCoords[0] & mask);
+}
+
+static void KeyCoords(uint64_t key, ivec3 archiveCoords)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		int value = (key >> (20 * a)) & 0xfffff;
+		archiveCoords[a] = value >= 0x80000 ? value - 0x100000 : value;
+	}
+}
+
+static uint32_t EntryChecksum(const ArchiveEntry *entry)
+{
+	return Crc32c((const uint8_t *)entry, offsetof(ArchiveEntry, checksum));
+}
+
+static inline uint64_t Extent(uint32_t firstPage, uint32_t numPages)
+{
+	return ((uint64_t)firstPage << 32) | numPages;
+}
+
+// Returns pages to the free list, merging them with free neighbors.
+static void FreePages(Archive *archive, uint32_t firstPage, uint32_t numPages)
+{
+	ListUInt64 *list = &archive->freePages;
+	ListUInt64Insert(list, Extent(firstPage, numPages));
+	qsort(list->values, list->size, sizeof(uint64_t), CompareUInt64);
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < list->size; i++)
+	{
+		uint64_t extent = list->values[i];
+
+		if (n > 0)
+		{
+			uint64_t last = list->values[n - 1];
+			uint32_t lastEnd = (last >> 32) + (uint32_t)last;
+
+			if (lastEnd == (extent >> 32))
+			{
+				list->values[n - 1] = Extent(last >> 32, (uint32_t)last + (uint32_t)extent);
+				continue;
+			}
+		}
+
+		list->values[n++] = extent;
+	}
+
+	list->size = n;
+}
+
+// Finds room for numPages pages, first fit, or at the end of the file.
+static uint32_t AllocatePages(Archive *archive, uint32_t numPages)
+{
+	ListUInt64 *list = &archive->freePages;
+
+	for (size_t i = 0; i < list->size; i++)
+	{
+		uint32_t first = list->values[i] >> 32;
+		uint32_t size = (uint32_t)list->values[i];
+		if (size < numPages) continue;
+
+		if (size == numPages) ListUInt64RemoveAt(list, i);
+		else list->values[i] = Extent(first + numPages, size - numPages);
+
+		return first;
+	}
+
+	uint32_t first = archive->numPages;
+	archive->numPages += numPages;
+	return first;
+}
+
+// Frees the pages of replaced data once no read is using the archive.
+static void ReleaseRetiredPages(Archive *archive)
+{
+	if (archive->numReaders > 0) return;
+
+	for (size_t i = 0; i < archive->retiredPages.size; i++)
+	{
+		uint64_t extent = archive->retiredPages.values[i];
+		FreePages(archive, extent >> 32, (uint32_t)extent);
+	}
+
+	archive->retiredPages.size = 0;
+}
+
+// Reads the index of an archive file, if there is one, and works out which pages are free.
+// Broken entries are dropped, so their regions are generated again.
+static void LoadIndex(Archive *archive)
+{
+	archive->numPages = ARCHIVE_DATA_PAGE;
+	FILE *file = fopen(archive->path, "rb");
+	if (file == NULL) return;
+
+	// the slots that older archives don't have stay empty
+	ArchiveHeader header = { 0 };
+	bool success = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == ARCHIVE_MAGIC && header.version == ARCHIVE_VERSION
+		&& header.numSlots >= ARCHIVE_REGION_SLOTS && header.numSlots <= ARCHIVE_NUM_SLOTS
+		&& fseek(file, ARCHIVE_INDEX_START, SEEK_SET) == 0
+		&& fread(archive->entries, sizeof(ArchiveEntry), header.numSlots, file) == header.numSlots;
+
+	long fileSize = -1;
+	if (fseek(file, 0, SEEK_END) == 0) fileSize = ftell(file);
+	fclose(file);
+
+	if (!success || fileSize < 0)
+	{
+		// Keep the broken file for inspection, and start over with an empty archive.
+		char brokenPath[PATH_FULLMAXLEN + 16];
+		snprintf(brokenPath, sizeof(brokenPath), "%s.broken", archive->path);
+		printf("Error: Archive %s is broken and was renamed to %s.\n", archive->path, brokenPath);
+		rename(archive->path, brokenPath);
+		memset(archive->entries, 0, sizeof(archive->entries));
+		return;
+	}
+
+	archive->exists = true;
+	archive->numSlots = header.numSlots;
+	uint32_t filePages = (fileSize + ARCHIVE_PAGE_SIZE - 1) / ARCHIVE_PAGE_SIZE;
+	if (filePages > archive->numPages) archive->numPages = filePages;
+
+	// the space between entries is free
+	uint64_t used[ARCHIVE_NUM_SLOTS];
+	int numUsed = 0;
+
+	for (int i = 0; i < ARCHIVE_NUM_SLOTS; i++)
+	{
+		ArchiveEntry *entry = archive->entries + i;
+		if (entry->size == 0 && entry->numPages == 0) continue;
+
+		uint64_t firstPage = entry->offset / ARCHIVE_PAGE_SIZE;
+
+		if (entry->checksum != EntryChecksum(entry) || entry->offset % ARCHIVE_PAGE_SIZE != 0
+			|| firstPage < ARCHIVE_DATA_PAGE || firstPage + entry->numPages > filePages
+			|| entry->size > (uint64_t)entry->numPages * ARCHIVE_PAGE_SIZE)
+		{
+			printf("Error: Slot %d of archive %s is broken.\n", i, archive->path);
+			memset(entry, 0, sizeof(ArchiveEntry));
+			continue;
+		}
+
+		used[numUsed++] = Extent(firstPage, entry->numPages);
+		archive->numUsedPages += entry->numPages;
+	}
+
+	qsort(used, numUsed, sizeof(uint64_t), CompareUInt64);
+	uint32_t page = ARCHIVE_DATA_PAGE;
+
+	for (int i = 0; i < numUsed; i++)
+	{
+		uint32_t first = used[i] >> 32;
+		if (first > page) FreePages(archive, page, first - page);
+		if (first + (uint32_t)used[i] > page) page = first + (uint32_t)used[i];
+	}
+
+	if (archive->numPages > page) FreePages(archive, page, archive->numPages - page);
+}
+
+// Returns the archive at archiveCoords, loading its index the first time. Caller must hold the set mutex.
+static Archive *GetArchive(ArchiveSet *set, ivec3 archiveCoords)
+{
+	uint64_t value;
+	if (HashMapUInt64Get(&set->archives, ArchiveKey(archiveCoords), &value)) return (void *)value;
+
+	Archive *archive = calloc(1, sizeof(Archive));
+	ListUInt64Init(&archive->freePages, 16);
+	ListUInt64Init(&archive->retiredPages, 16);
+
+	// named after the L0 chunk coords of the corner, like the old region directories
+	const int side = ARCHIVE_SIDE * 8;
+	snprintf(archive->path, sizeof(archive->path), "%s/%+04d_%+04d_%+04d.pack", set->folderPath,
+		archiveCoords[0] * side, archiveCoords[1] * side, archiveCoords[2] * side);
+
+	LoadIndex(archive);
+	HashMapUInt64Set(&set->archives, ArchiveKey(archiveCoords), (uint64_t)archive);
+	ListUInt64Insert(&set->allArchives, (uint64_t)archive);
+	return archive;
+}
+
+ArchiveSet *Archive_OpenSet(char *folderPath)
+{
+	ArchiveSet *set = calloc(1, sizeof(ArchiveSet));
+	if (set == NULL) return NULL;
+
+	set->folderPath = folderPath;
+	set->mutex = SDL_CreateMutex();
+	HashMapUInt64Init(&set->archives, 64);
+	ListUInt64Init(&set->allArchives, 64);
+
+	// make sure the world folder exists, since archives are created right in it
+	char buffer[PATH_FULLMAXLEN];
+	PathBuilder path = { .dirs = &folderPath, .file = NULL, .ext = NULL, .numDirs = 1 };
+	Path_BuildStrAndMakeDirs(buffer, path);
+
+	return set;
+}
+
+void Archive_CloseSet(ArchiveSet *set)
+{
+	if (set == NULL) return;
+
+	for (size_t i = 0; i < set->allArchives.size; i++)
+	{
+		Archive *archive = (void *)set->allArchives.values[i];
+		free(archive->freePages.values);
+		free(archive->retiredPages.values);
+		free(archive);
+	}
+
+	free(set->allArchives.values);
+	HashMapUInt64Free(&set->archives);
+	SDL_DestroyMutex(set->mutex);
+	free(set);
+}
+
+// Sets up a read of a region's file from its archive. Returns false if the archive doesn't have the region.
+// Otherwise the data stays where it is until Archive_EndRead is called. pathBuffer must hold PATH_FULLMAXLEN bytes.
+bool Archive_BeginRead(ArchiveSet *set, ivec3 baseCoords, int lodLevel, char *pathBuffer, FileRead *read)
+{
+	ivec3 archiveCoords;
+	int slot = GetSlot(baseCoords, lodLevel, archiveCoords);
+
+	SDL_LockMutex(set->mutex);
+	Archive *archive = GetArchive(set, archiveCoords);
+	ArchiveEntry entry = archive->entries[slot];
+	if (entry.size > 0) archive->numReaders++;
+	SDL_UnlockMutex(set->mutex);
+
+	if (entry.size == 0) return false;
+
+	snprintf(pathBuffer, PATH_FULLMAXLEN, "%s", archive->path);
+	read->path = pathBuffer;
+	read->offset = entry.offset;
+	read->size = entry.size;
+	return true;
+}
+
+void Archive_EndRead(ArchiveSet *set, ivec3 baseCoords)
+{
+	ivec3 archiveCoords;
+	GetSlot(baseCoords, 0, archiveCoords);
+
+	SDL_LockMutex(set->mutex);
+	Archive *archive = GetArchive(set, archiveCoords);
+	archive->numReaders--;
+	ReleaseRetiredPages(archive);
+	SDL_UnlockMutex(set->mutex);
+}
+
+// Writes the header and index of an archive file.
+static bool WriteIndex(int fd, const ArchiveEntry *entries)
+{
+	ArchiveHeader header = { 0 };
+	header.magic = ARCHIVE_MAGIC;
+	header.version = ARCHIVE_VERSION;
+	header.numSlots = ARCHIVE_NUM_SLOTS;
+
+	size_t indexSize = ARCHIVE_NUM_SLOTS * sizeof(ArchiveEntry);
+	return pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+		&& pwrite(fd, entries, indexSize, ARCHIVE_INDEX_START) == (ssize_t)indexSize;
+}
+
+// Copies the regions of an archive into a new file without gaps, which then replaces the archive.
+// The copy is made without holding the set mutex, so reads can go on meanwhile. Since all the offsets change, the new
+// file is only swapped in if no read is using the archive by then, otherwise it is dropped until the next try.
+// Only the thread that writes regions may call this.
+static void Compact(ArchiveSet *set, Archive *archive)
+{
+	char tempPath[PATH_FULLMAXLEN + 16];
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp", archive->path);
+
+	int source = open(archive->path, O_RDONLY);
+	int dest = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool success = source >= 0 && dest >= 0;
+
+	// Only this thread changes the entries, so they stay the same during the copy.
+	ArchiveEntry entries[ARCHIVE_NUM_SLOTS];
+	memset(entries, 0, sizeof(entries));
+	uint32_t page = ARCHIVE_DATA_PAGE;
+	uint8_t *buffer = NULL;
+
+	for (int i = 0; i < ARCHIVE_NUM_SLOTS && success; i++)
+	{
+		ArchiveEntry *entry = archive->entries + i;
+		if (entry->size == 0) continue;
+
+		buffer = realloc(buffer, entry->size);
+		entries[i].offset = (uint64_t)page * ARCHIVE_PAGE_SIZE;
+		entries[i].size = entry->size;
+		entries[i].numPages = entry->numPages;
+		entries[i].checksum = EntryChecksum(entries + i);
+		page += entry->numPages;
+
+		success = pread(source, buffer, entry->size, entry->offset) == entry->size
+			&& pwrite(dest, buffer, entry->size, entries[i].offset) == entry->size;
+	}
+
+	free(buffer);
+	if (source >= 0) close(source);
+
+	success = success && WriteIndex(dest, entries) && ftruncate(dest, (off_t)page * ARCHIVE_PAGE_SIZE) == 0 && fsync(dest) == 0;
+	if (dest >= 0 && close(dest) != 0) success = false;
+
+	SDL_LockMutex(set->mutex);
+	bool swapped = success && archive->numReaders == 0 && rename(tempPath, archive->path) == 0;
+
+	if (swapped)
+	{
+		memcpy(archive->entries, entries, sizeof(entries));
+		archive->numSlots = ARCHIVE_NUM_SLOTS;
+		archive->numPages = page;
+		archive->freePages.size = 0;
+		archive->retiredPages.size = 0;
+	}
+
+	SDL_UnlockMutex(set->mutex);
+
+	if (!swapped)
+	{
+		remove(tempPath);
+		if (!success) printf("Error: Could not compact archive %s.\n", archive->path);
+		return;
+	}
+
+	Path_SyncParentDir(archive->path);
+}
+
+// Compacts an archive if most of it is free space, and nothing is reading it. Caller must not hold the set mutex.
+static void CompactIfWasteful(ArchiveSet *set, Archive *archive)
+{
+	SDL_LockMutex(set->mutex);
+	uint64_t freeBytes = (uint64_t)(archive->numPages - ARCHIVE_DATA_PAGE - archive->numUsedPages) * ARCHIVE_PAGE_SIZE;
+	uint64_t usedBytes = (uint64_t)archive->numUsedPages * ARCHIVE_PAGE_SIZE;
+	bool wasteful = archive->numReaders == 0 && freeBytes > ARCHIVE_COMPACT_MIN && freeBytes > usedBytes;
+	SDL_UnlockMutex(set->mutex);
+
+	if (wasteful) Compact(set, archive);
+}
+
+typedef struct
+{
+	Archive *archive;
+	int fd;
+	bool success;
+} OpenArchive;
+
+// Stores region files in their archives, and returns once they are on disk.
+// All the data is written and synced before any index entry is switched over, so each archive only needs two syncs.
+// The success flag of each write is set.
+void Archive_WriteRegions(ArchiveSet *set, ArchiveWrite *writes, int numWrites)
+{
+	Archive *archives[numWrites];
+	int slots[numWrites];
+	ArchiveEntry entries[numWrites];
+	OpenArchive files[numWrites]; // each archive once
+	int numOpen = 0;
+
+	// Reserve new pages for all of them. Only this thread writes, so nothing else can take the pages meanwhile.
+	SDL_LockMutex(set->mutex);
+
+	for (int i = 0; i < numWrites; i++)
+	{
+		ivec3 archiveCoords;
+		slots[i] = GetSlot(writes[i].baseCoords, writes[i].lodLevel, archiveCoords);
+		archives[i] = GetArchive(set, archiveCoords);
+
+		ReleaseRetiredPages(archives[i]);
+		uint32_t numPages = (writes[i].size + ARCHIVE_PAGE_SIZE - 1) / ARCHIVE_PAGE_SIZE;
+		memset(entries + i, 0, sizeof(ArchiveEntry));
+		entries[i].offset = (uint64_t)AllocatePages(archives[i], numPages) * ARCHIVE_PAGE_SIZE;
+		entries[i].size = writes[i].size;
+		entries[i].numPages = numPages;
+		entries[i].checksum = EntryChecksum(entries + i);
+
+		int j = 0;
+		while (j < numOpen && files[j].archive != archives[i]) j++;
+
+		if (j == numOpen)
+		{
+			files[numOpen].archive = archives[i];
+			files[numOpen].fd = -1;
+			files[numOpen].success = true;
+			numOpen++;
+		}
+	}
+
+	SDL_UnlockMutex(set->mutex);
+
+	for (int j = 0; j < numOpen; j++)
+	{
+		Archive *archive = files[j].archive;
+		files[j].fd = open(archive->path, O_RDWR | O_CREAT, 0644);
+
+		// A new file gets an empty index, so it is valid before any region is in it. An older file gets the longer
+		// index, which only adds empty entries. Only this thread changes the entries, so they match the file.
+		bool writeIndex = !archive->exists || archive->numSlots < ARCHIVE_NUM_SLOTS;
+
+		if (files[j].fd < 0 || (writeIndex && !WriteIndex(files[j].fd, archive->entries)))
+			files[j].success = false;
+		else
+			archive->numSlots = ARCHIVE_NUM_SLOTS;
+	}
+
+	for (int i = 0; i < numWrites; i++)
+	{
+		int j = 0;
+		while (files[j].archive != archives[i]) j++;
+
+		writes[i].success = files[j].success
+			&& pwrite(files[j].fd, writes[i].data, writes[i].size, entries[i].offset) == (ssize_t)writes[i].size;
+	}
+
+	for (int j = 0; j < numOpen; j++)
+		if (files[j].success) files[j].success = fsync(files[j].fd) == 0;
+
+	// Now the index entries can point to the new data. Each entry is written in one piece.
+	for (int i = 0; i < numWrites; i++)
+	{
+		int j = 0;
+		while (files[j].archive != archives[i]) j++;
+
+		off_t entryPos = ARCHIVE_INDEX_START + (slots[i] * sizeof(ArchiveEntry));
+		writes[i].success = writes[i].success && files[j].success
+			&& pwrite(files[j].fd, entries + i, sizeof(ArchiveEntry), entryPos) == sizeof(ArchiveEntry);
+	}
+
+	for (int j = 0; j < numOpen; j++)
+	{
+		bool synced = files[j].fd >= 0 && fsync(files[j].fd) == 0;
+		if (files[j].fd >= 0) close(files[j].fd);
+
+		if (!synced) files[j].success = false;
+		if (files[j].success && !files[j].archive->exists) Path_SyncParentDir(files[j].archive->path);
+	}
+
+	SDL_LockMutex(set->mutex);
+
+	for (int i = 0; i < numWrites; i++)
+	{
+		Archive *archive = archives[i];
+		int j = 0;
+		while (files[j].archive != archive) j++;
+
+		if (!files[j].success) writes[i].success = false;
+
+		uint32_t firstPage = entries[i].offset / ARCHIVE_PAGE_SIZE;
+
+		if (!writes[i].success)
+		{
+			FreePages(archive, firstPage, entries[i].numPages);
+			continue;
+		}
+
+		// Reads that started before this may still be reading the old data.
+		ArchiveEntry *old = archive->entries + slots[i];
+
+		if (old->size > 0)
+		{
+			ListUInt64Insert(&archive->retiredPages, Extent(old->offset / ARCHIVE_PAGE_SIZE, old->numPages));
+			archive->numUsedPages -= old->numPages;
+		}
+
+		*old = entries[i];
+		archive->numUsedPages += entries[i].numPages;
+		archive->exists = true;
+	}
+
+	for (int j = 0; j < numOpen; j++)
+		ReleaseRetiredPages(files[j].archive);
+
+	SDL_UnlockMutex(set->mutex);
+
+	for (int j = 0; j < numOpen; j++)
+		CompactIfWasteful(set, files[j].archive);
+}
+
+// Collects the keys of the archive files in a world folder, named like "+032_-064_+000.pack".
+static void CollectArchive(char *fullPath, void *data)
+{
+	ListUInt64 *keys = data;
+	char *name = strrchr(fullPath, '/');
+	name = (name == NULL) ? fullPath : name + 1;
+
+	const int side = ARCHIVE_SIDE * 8;
+	ivec3 corner;
+	int length = 0;
+
+	if (sscanf(name, "%d_%d_%d.pack%n", &corner[0], &corner[1], &corner[2], &length) != 3 || name[length] != '\0') return;
+	if (corner[0] % side != 0 || corner[1] % side != 0 || corner[2] % side != 0) return;
+
+	ivec3 archiveCoords = { corner[0] / side, corner[1] / side, corner[2] / side };
+	ListUInt64Insert(keys, ArchiveKey(archiveCoords));
+}
+
+// Calls the visitor for every region in the archives of the set's folder, and returns how many there were.
+// The visitor may read the regions, and may also write regions, since the archive isn't compacted while it is visited.
+int Archive_VisitRegions(ArchiveSet *set, ArchiveVisitor visitor, void *data)
+{
+	ListUInt64 keys;
+	ListUInt64Init(&keys, 64);
+	Path_VisitFiles(set->folderPath, CollectArchive, &keys);
+	qsort(keys.values, keys.size, sizeof(uint64_t), CompareUInt64);
+
+	int numRegions = 0;
+
+	for (size_t k = 0; k < keys.size; k++)
+	{
+		ivec3 archiveCoords;
+		KeyCoords(keys.values[k], archiveCoords);
+
+		// the data of the entries stays where it is until the reads are done
+		ArchiveEntry entries[ARCHIVE_NUM_SLOTS];
+		SDL_LockMutex(set->mutex);
+		Archive *archive = GetArchive(set, archiveCoords);
+		memcpy(entries, archive->entries, sizeof(entries));
+		archive->numReaders++;
+		SDL_UnlockMutex(set->mutex);
+
+		for (int i = 0; i < ARCHIVE_NUM_SLOTS; i++)
+		{
+			if (entries[i].size == 0) continue;
+
+			ArchivedRegion region;
+			region.lodLevel = SlotRegion(i, archiveCoords, region.baseCoords);
+			region.path = archive->path;
+			region.offset = entries[i].offset;
+			region.size = entries[i].size;
+
+			visitor(&region, data);
+			numRegions++;
+		}
+
+		SDL_LockMutex(set->mutex);
+		archive->numReaders--;
+		ReleaseRetiredPages(archive);
+		SDL_UnlockMutex(set->mutex);
+	}
+
+	free(keys.values);
+	return numRegions;
+}
+
+static void CollectRegionFile(char *fullPath, void *data)
+{
+	ListUInt64 *paths = data;
+	char *name = strrchr(fullPath, '/');
+	name = (name == NULL) ? fullPath : name + 1;
+
+	if (name[0] >= '0' && name[0] <= '3' && strcmp(name + 1, ".chunk") == 0)
+		ListUInt64Insert(paths, (uint64_t)strdup(fullPath));
+}
+
+typedef struct
+{
+	char *path;
+	RegionFile rf;
+	uint8_t *encoded; // the region in the current format, if the file has an older one
+} ConvertedFile;
+
+// Writes a batch of converted region files to their archives, then removes the ones that made it.
+static int FinishConversion(ArchiveSet *set, ConvertedFile *files, ArchiveWrite *writes, int numFiles)
+{
+	int numConverted = 0;
+	Archive_WriteRegions(set, writes, numFiles);
+
+	for (int i = 0; i < numFiles; i++)
+	{
+		RegionFile_Close(&files[i].rf);
+		free(files[i].encoded);
+
+		if (writes[i].success)
+		{
+			remove(files[i].path);
+			numConverted++;
+		}
+		else
+		{
+			printf("Error: Could not pack %s.\n", files[i].path);
+		}
+	}
+
+	return numConverted;
+}
+
+// Moves the region files of a world folder with a directory per L3 region into archives, and removes the directories
+// that end up empty. Legacy files are upgraded on the way. Returns the number of files that were packed.
+int Archive_ConvertFolder(char *folderPath)
+{
+	ListUInt64 paths;
+	ListUInt64Init(&paths, 256);
+	Path_VisitFiles(folderPath, CollectRegionFile, &paths);
+
+	ArchiveSet *set = Archive_OpenSet(folderPath);
+	ConvertedFile files[ARCHIVE_CONVERT_BATCH];
+	ArchiveWrite writes[ARCHIVE_CONVERT_BATCH];
+	int numFiles = 0;
+	int numConverted = 0;
+	int numStale = 0;
+	CodecContext codec;
+	CodecContext_Init(&codec);
+
+	for (size_t p = 0; p < paths.size; p++)
+	{
+		char *path = (char *)paths.values[p];
+		char *name = strrchr(path, '/');
+		int lodLevel = name[1] - '0';
+
+		// the directory is named after the L0 chunk coords of the L3 region, like "+000_-008_+000"
+		char *dir = name - 1;
+		while (dir > path && dir[-1] != '/') dir--;
+
+		ivec3 baseCoords;
+		if (sscanf(dir, "%d_%d_%d/", &baseCoords[0], &baseCoords[1], &baseCoords[2]) != 3) continue;
+
+		// A region that is already in an archive was saved after this file, so the file is outdated.
+		ivec3 archiveCoords;
+		int slot = GetSlot(baseCoords, lodLevel, archiveCoords);
+		SDL_LockMutex(set->mutex);
+		bool stale = GetArchive(set, archiveCoords)->entries[slot].size > 0;
+		SDL_UnlockMutex(set->mutex);
+
+		if (stale)
+		{
+			remove(path);
+			numStale++;
+			continue;
+		}
+
+		ConvertedFile *file = files + numFiles;
+		ArchiveWrite *write = writes + numFiles;
+		file->path = path;
+		file->encoded = NULL;
+
+		if (!RegionFile_Open(&file->rf, path, lodLevel))
+		{
+			printf("Error: Could not read %s.\n", path);
+			continue;
+		}
+
+		glm_ivec3_copy(baseCoords, write->baseCoords);
+		write->lodLevel = lodLevel;
+		write->data = file->rf.file.data;
+		write->size = file->rf.file.size;
+
+		if (file->rf.version != REGION_VERSION)
+		{
+			int numChunks = file->rf.numChunks;
+			BlockStorage *blocks = calloc(numChunks, sizeof(BlockStorage));
+			bool success = true;
+
+			for (int i = 0; i < numChunks && success; i++)
+				success = RegionFile_ReadChunk(&file->rf, i, blocks + i, &codec);
+
+			if (success) file->encoded = Region_Encode(&codec, lodLevel, blocks, numChunks, CODEC_RLE_ZLIB, &write->size);
+
+			for (int i = 0; i < numChunks; i++)
+				Blocks_Free(blocks + i);
+
+			free(blocks);
+
+			if (!success)
+			{
+				printf("Error: Could not read %s.\n", path);
+				RegionFile_Close(&file->rf);
+				continue;
+			}
+
+			write->data = file->encoded;
+		}
+
+		if (++numFiles == ARCHIVE_CONVERT_BATCH)
+		{
+			numConverted += FinishConversion(set, files, writes, numFiles);
+			numFiles = 0;
+		}
+	}
+
+	if (numFiles > 0) numConverted += FinishConversion(set, files, writes, numFiles);
+
+	// remove the directories that are empty now
+	for (size_t p = 0; p < paths.size; p++)
+	{
+		char *path = (char *)paths.values[p];
+		*strrchr(path, '/') = '\0';
+		rmdir(path);
+		free(path);
+	}
+
+	printf("Packed %d of %d region files in %s, and removed %d outdated ones.\n", numConverted, (int)paths.size - numStale, folderPath, numStale);
+	free(paths.values);
+	CodecContext_Free(&codec);
+	Archive_CloseSet(set);
+	return numConverted;
+}
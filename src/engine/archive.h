@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cglm/cglm.h"
+#include "readbatch.h"
+
+struct ArchiveSet;
+typedef struct ArchiveSet ArchiveSet;
+
+// One region file to store in an archive.
+typedef struct
+{
+	ivec3 baseCoords;
+	int lodLevel;
+	const uint8_t *data;
+	size_t size;
+	bool success; // set by the write
+} ArchiveWrite;
+
+// Where a region file is stored, as found in an archive's index.
+typedef struct
+{
+	ivec3 baseCoords;
+	int lodLevel;
+	const char *path; // of the archive
+	uint64_t offset;
+	size_t size;
+} ArchivedRegion;
+
+typedef void (*ArchiveVisitor)(const ArchivedRegion *region, void *data);
+
+ArchiveSet *Archive_OpenSet(char *folderPath);
+void Archive_CloseSet(ArchiveSet *set);
+bool Archive_BeginRead(ArchiveSet *set, ivec3 baseCoords, int lodLevel, char *pathBuffer, FileRead *read);
+void Archive_EndRead(ArchiveSet *set, ivec3 baseCoords);
+void Archive_WriteRegions(ArchiveSet *set, ArchiveWrite *writes, int numWrites);
+int Archive_VisitRegions(ArchiveSet *set, ArchiveVisitor visitor, void *data);
+int Archive_ConvertFolder(char *folderPath);
@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blocks.h"
+
+static inline size_t DataWords(int bits)
+{
+	return ((size_t)BLOCKS_PER_CHUNK * bits) / 64;
+}
+
+// Returns the narrowest index width that can hold paletteSize types.
+int Blocks_BitsForPaletteSize(int paletteSize)
+{
+	if (paletteSize <= 1) return 0;
+	if (paletteSize <= 2) return 1;
+	if (paletteSize <= 4) return 2;
+	if (paletteSize <= 16) return 4;
+	return 8;
+}
+
+static inline int GetIndex(const uint64_t* data, int bits, int i)
+{
+	int bit = i * bits;
+	return (data[bit >> 6] >> (bit & 63)) & ((1u << bits) - 1);
+}
+
+static inline void SetIndex(uint64_t* data, int bits, int i, int value)
+{
+	int bit = i * bits;
+	uint64_t mask = ((1ull << bits) - 1) << (bit & 63);
+	data[bit >> 6] = (data[bit >> 6] & ~mask) | ((uint64_t)value << (bit & 63));
+}
+
+// Sets every block to one type and frees the index data.
+void Blocks_Fill(BlockStorage* storage, uint8_t type)
+{
+	free(storage->data);
+	storage->data = NULL;
+	storage->bits = 0;
+	storage->paletteSize = 1;
+	storage->palette[0] = type;
+}
+
+void Blocks_Free(BlockStorage* storage)
+{
+	Blocks_Fill(storage, 0);
+}
+
+// Replaces the contents of dest with a copy of src.
+void Blocks_Copy(BlockStorage* dest, const BlockStorage* src)
+{
+	free(dest->data);
+	*dest = *src;
+
+	if (src->bits != 0)
+	{
+		dest->data = malloc(Blocks_MemorySize(src));
+		memcpy(dest->data, src->data, Blocks_MemorySize(src));
+	}
+}
+
+// Repacks the indices with a wider bit width.
+static void Widen(BlockStorage* storage, int bits)
+{
+	uint64_t* data = calloc(DataWords(bits), sizeof(uint64_t));
+
+	// 0-bit storage has nothing to copy, since calloc already set every index to 0
+	if (storage->bits != 0)
+	{
+		for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+			SetIndex(data, bits, i, GetIndex(storage->data, storage->bits, i));
+	}
+
+	free(storage->data);
+	storage->data = data;
+	storage->bits = bits;
+}
+
+// Sets the type of the block at a z-order index, widening the indices if the type is new and doesn't fit.
+void Blocks_Set(BlockStorage* storage, int index, uint8_t type)
+{
+	int p = 0;
+	while (p < storage->paletteSize && storage->palette[p] != type) p++;
+
+	if (p == storage->paletteSize)
+	{
+		if (storage->paletteSize == (1 << storage->bits))
+			Widen(storage, Blocks_BitsForPaletteSize(storage->paletteSize + 1));
+
+		storage->palette[storage->paletteSize++] = type;
+	}
+
+	if (storage->bits != 0) SetIndex(storage->data, storage->bits, index, p);
+}
+
+// Replaces the contents with raw block types in z-order, using the narrowest indices that fit.
+void Blocks_Pack(BlockStorage* storage, const uint8_t* raw)
+{
+	Blocks_Fill(storage, raw[0]);
+
+	// Most chunks are all one type, which is quick to check eight blocks at a time.
+	uint64_t pattern = raw[0] * 0x0101010101010101ull;
+	int same = 0;
+
+	for (; same < BLOCKS_PER_CHUNK; same += 8)
+	{
+		uint64_t eight;
+		memcpy(&eight, raw + same, 8);
+		if (eight != pattern) break;
+	}
+
+	if (same == BLOCKS_PER_CHUNK) return;
+
+	int16_t lookup[256];
+	memset(lookup, -1, sizeof(lookup));
+	storage->paletteSize = 0;
+
+	for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+	{
+		if (lookup[raw[i]] < 0)
+		{
+			lookup[raw[i]] = storage->paletteSize;
+			storage->palette[storage->paletteSize++] = raw[i];
+		}
+	}
+
+	int bits = Blocks_BitsForPaletteSize(storage->paletteSize);
+	uint64_t* data = malloc(DataWords(bits) * sizeof(uint64_t));
+	int perWord = 64 / bits;
+
+	for (size_t w = 0; w < DataWords(bits); w++)
+	{
+		const uint8_t* src = raw + (w * perWord);
+		uint64_t word = 0;
+
+		for (int j = 0; j < perWord; j++)
+			word |= (uint64_t)lookup[src[j]] << (j * bits);
+
+		data[w] = word;
+	}
+
+	storage->data = data;
+	storage->bits = bits;
+}
+
+static inline void UnpackBytes(const uint64_t* data, size_t numWords, const uint64_t* table, int perByte, uint8_t* raw)
+{
+	for (size_t w = 0; w < numWords; w++)
+	{
+		uint64_t word = data[w];
+
+		for (int k = 0; k < 8; k++)
+		{
+			uint64_t types = table[(word >> (k * 8)) & 0xff];
+			memcpy(raw, &types, perByte);
+			raw += perByte;
+		}
+	}
+}
+
+// Writes out the block types in z-order. raw must hold BLOCKS_PER_CHUNK bytes.
+void Blocks_Unpack(const BlockStorage* storage, uint8_t* raw)
+{
+	int bits = storage->bits;
+
+	if (bits == 0)
+	{
+		memset(raw, storage->palette[0], BLOCKS_PER_CHUNK);
+		return;
+	}
+
+	// Each byte of index data holds 8 / bits indices, so a table maps it straight to that many block types.
+	int perByte = 8 / bits;
+	int mask = (1 << bits) - 1;
+	uint64_t table[256];
+
+	for (int b = 0; b < 256; b++)
+	{
+		uint64_t types = 0;
+
+		for (int j = 0; j < perByte; j++)
+			types |= (uint64_t)storage->palette[(b >> (j * bits)) & mask] << (j * 8);
+
+		table[b] = types;
+	}
+
+	// each call gets its own copy of the loop with a constant width
+	switch (perByte)
+	{
+	case 8: UnpackBytes(storage->data, DataWords(bits), table, 8, raw); break;
+	case 4: UnpackBytes(storage->data, DataWords(bits), table, 4, raw); break;
+	case 2: UnpackBytes(storage->data, DataWords(bits), table, 2, raw); break;
+	default: UnpackBytes(storage->data, DataWords(bits), table, 1, raw); break;
+	}
+}
+
+// Returns the size of the index data in bytes.
+size_t Blocks_MemorySize(const BlockStorage* storage)
+{
+	return DataWords(storage->bits) * sizeof(uint64_t);
+}
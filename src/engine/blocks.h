@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+enum
+{
+	BLOCKS_PER_CHUNK = 64 * 64 * 64,
+};
+
+// Block types of one chunk in z-order, stored as indices into a palette of the types in use.
+// Indices take 0, 1, 2, 4 or 8 bits, and the width grows when a new type no longer fits.
+// With 0 bits there is no index data, and every block is palette[0].
+typedef struct
+{
+	uint64_t* data;
+	uint16_t paletteSize;
+	uint8_t bits;
+	uint8_t palette[256];
+} BlockStorage;
+
+void Blocks_Fill(BlockStorage* storage, uint8_t type);
+void Blocks_Free(BlockStorage* storage);
+void Blocks_Copy(BlockStorage* dest, const BlockStorage* src);
+void Blocks_Set(BlockStorage* storage, int index, uint8_t type);
+void Blocks_Pack(BlockStorage* storage, const uint8_t* raw);
+void Blocks_Unpack(const BlockStorage* storage, uint8_t* raw);
+size_t Blocks_MemorySize(const BlockStorage* storage);
+int Blocks_BitsForPaletteSize(int paletteSize);
+
+// Returns the type of the block at a z-order index.
+static inline uint8_t Blocks_Get(const BlockStorage* storage, int index)
+{
+	int bits = storage->bits;
+	if (bits == 0) return storage->palette[0];
+
+	int bit = index * bits;
+	uint64_t word = storage->data[bit >> 6];
+	return storage->palette[(word >> (bit & 63)) & ((1u << bits) - 1)];
+}
+
+// Returns true if every block has the same type, which is then palette[0].
+static inline bool Blocks_IsUniform(const BlockStorage* storage)
+{
+	return storage->bits == 0;
+}
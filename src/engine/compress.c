@@ -1,236 +1,985 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "compress.h"
 #include "world.h"
+#include "blocks.h"
 #include "zhelp.h"
 #include "zlib.h"
+#include "lz.h"
+#include "rle.h"
 #include "lod.h"
+#include "filesystem.h"
+#include "readbatch.h"
 
-typedef struct
+static const uint32_t crc32cTable[256] =
+{
+	0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+	0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b, 0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+	0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+	0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+	0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a, 0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+	0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+	0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+	0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a, 0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+	0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+	0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+	0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927, 0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+	0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+	0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+	0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859, 0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+	0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+	0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+	0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c, 0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+	0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+	0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+	0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c, 0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+	0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+	0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+	0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d, 0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+	0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+	0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+	0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff, 0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+	0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+	0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+	0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee, 0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+	0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+	0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+	0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e, 0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+static uint32_t Crc32cSoftware(const uint8_t *data, size_t size)
 {
-	uint32_t numBytes;
-	uint32_t numRuns;
-} RleInfo;
+	uint32_t crc = 0xffffffff;
+
+	for (size_t i = 0; i < size; i++)
+		crc = crc32cTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
 
-// Compresses a chunk with run-length encoding (RLE).
-// Caller is responsible for managing both of the buffers.
-static RleInfo Rle_EncodeChunk(uint8_t *raw, uint8_t *rle)
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define REGION_CRC_SSE42
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(const uint8_t *data, size_t size)
 {
-	const int sideSize = 64;
-	const int fullSize = sideSize * sideSize * sideSize;
-	RleInfo info = { .numBytes = 0, .numRuns = 0 };
-	int b = 0; // byte index for output
-	int runLength = 1;
-	uint8_t runBlock = raw[0];
-	uint8_t curBlock = runBlock;
+	uint64_t crc = 0xffffffff;
+	size_t i = 0;
 
-	// Start at 1 because the first one has been read.
-	// One extra iteration for the special case at the end.
-	for (int i = 1; i <= fullSize; i++)
+	for (; i + 8 <= size; i += 8)
 	{
-		if (i == fullSize) goto end_run; // end the last run
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		crc = _mm_crc32_u64(crc, word);
+	}
 
-		curBlock = raw[i];
+	for (; i < size; i++)
+		crc = _mm_crc32_u8((uint32_t)crc, data[i]);
 
-		if (curBlock == runBlock)
-		{
-			runLength++;
-			continue;
-		}
+	return ~(uint32_t)crc;
+}
+#endif
 
-		end_run:
-		int numBytes;
+// Computes the CRC32C (Castagnoli) checksum of a buffer, with the CPU's crc32 instruction if it has one.
+uint32_t Crc32c(const uint8_t *data, size_t size)
+{
+#ifdef REGION_CRC_SSE42
+	if (__builtin_cpu_supports("sse4.2")) return Crc32cSse42(data, size);
+#endif
+	return Crc32cSoftware(data, size);
+}
 
-		// encode the run length, which uses a variable number of bytes
-		if (runLength > 0xffff)
-		{
-			numBytes = 6;
-			rle[b++] = 0xff; // four-byte length indicator
-			rle[b++] = (uint8_t)runLength;
-			rle[b++] = (uint8_t)(runLength >> 8);
-			rle[b++] = (uint8_t)(runLength >> 16);
-			rle[b++] = (uint8_t)(runLength >> 24);
-		}
-		else if (runLength > 0xfe)
-		{
-			numBytes = 4;
-			rle[b++] = 0; // two-byte length indicator
-			rle[b++] = (uint8_t)runLength;
-			rle[b++] = (uint8_t)(runLength >> 8);
-		}
-		else
-		{
-			numBytes = 2;
-			rle[b++] = (uint8_t)runLength;
-		}
+void CodecContext_Init(CodecContext *ctx)
+{
+	ctx->z = Z_NewContext();
+	ctx->rle = malloc(REGION_RLE_BUFFER_SIZE);
+	ctx->compressed = malloc(REGION_RLE_BUFFER_SIZE);
+	ctx->raw = malloc(BLOCKS_PER_CHUNK);
+}
 
-		// encode the block type of the run
-		rle[b++] = runBlock;
+void CodecContext_Free(CodecContext *ctx)
+{
+	Z_FreeContext(ctx->z);
+	free(ctx->rle);
+	free(ctx->compressed);
+	free(ctx->raw);
+	memset(ctx, 0, sizeof(CodecContext));
+}
 
-		// track the total size and number of runs
-		info.numBytes += numBytes;
-		info.numRuns++;
+// Encodes one chunk with RLE and the given compression codec, or with no compression if that's smaller.
+// data is set to the stored bytes, which are in one of the context's buffers, or NULL for a uniform chunk.
+static RegionEntry EncodeChunk(CodecContext *ctx, const BlockStorage *blocks, ChunkCodec codec, const uint8_t **data)
+{
+	RegionEntry entry = { 0 };
+	*data = NULL;
 
-		// start next run
-		runLength = 1;
-		runBlock = curBlock;
+	if (Blocks_IsUniform(blocks))
+	{
+		entry.codec = CODEC_UNIFORM;
+		entry.numRuns = blocks->palette[0];
+		return entry;
 	}
 
-	return info;
+	RleInfo info = Rle_EncodeChunk(blocks, ctx->rle);
+	entry.numRuns = info.numRuns;
+
+	// the compressor only gets enough room to beat the RLE
+	int compressedSize = 0;
+
+	if (codec == CODEC_RLE_LZ)
+		compressedSize = Lz_Compress(ctx->rle, info.numBytes, ctx->compressed, info.numBytes - 1);
+	else if (Z_Deflate(ctx->z, ctx->rle, info.numBytes, ctx->compressed, info.numBytes - 1, &compressedSize) != Z_OK)
+		compressedSize = 0;
+
+	if (compressedSize > 0)
+	{
+		entry.codec = codec;
+		entry.size = compressedSize;
+		*data = ctx->compressed;
+	}
+	else if (info.numBytes < BLOCKS_PER_CHUNK)
+	{
+		entry.codec = CODEC_RLE;
+		entry.size = info.numBytes;
+		*data = ctx->rle;
+	}
+	else
+	{
+		Blocks_Unpack(blocks, ctx->raw);
+		entry.codec = CODEC_RAW;
+		entry.size = BLOCKS_PER_CHUNK;
+		*data = ctx->raw;
+	}
+
+	entry.checksum = Crc32c(*data, entry.size);
+	return entry;
 }
 
-// Fills in the raw blocks of a chunk from RLE.
-// Caller is responsible for managing both of the buffers.
-static void Rle_DecodeChunk(uint8_t *raw, uint8_t *rle, RleInfo info)
+// Copies the stored bytes of a chunk to the end of a region file that is being put together, and sets the entry's
+// offset and capacity. The file grows as needed. Returns the new end of the file.
+static uint32_t AppendChunk(uint8_t **file, size_t *capacity, uint32_t contentPos, RegionEntry *entry, const uint8_t *data)
 {
-	const int sideSize = 64;
-	const int fullSize = sideSize * sideSize * sideSize;
-	int n = 0; // number of blocks written to the chunk
-	int b = 0; // byte index of rle
+	entry->offset = contentPos;
+	entry->capacity = (entry->size + REGION_CHUNK_ALIGNMENT - 1) / REGION_CHUNK_ALIGNMENT * REGION_CHUNK_ALIGNMENT;
 
-	for (int i = 0; i < info.numRuns; i++)
+	if (contentPos + entry->capacity > *capacity)
 	{
-		uint8_t firstByte = rle[b++];
-		int runLength;
+		while (contentPos + entry->capacity > *capacity) *capacity *= 2;
+		*file = realloc(*file, *capacity);
+	}
+
+	// the padding is zeroed, so the file doesn't depend on what was in memory
+	if (entry->size > 0) memcpy(*file + contentPos, data, entry->size);
+	memset(*file + contentPos + entry->size, 0, entry->capacity - entry->size);
+
+	return contentPos + entry->capacity;
+}
+
+// The chunk data goes after the header and table, which are filled in last.
+static inline uint32_t RegionContentStart(int numChunks)
+{
+	return sizeof(RegionHeader) + (numChunks * sizeof(RegionEntry));
+}
+
+static void WriteRegionHeader(uint8_t *file, int lodLevel, const RegionEntry *entries, int numChunks)
+{
+	RegionHeader header = { 0 };
+	header.magic = REGION_MAGIC;
+	header.version = REGION_VERSION;
+	header.lodLevel = lodLevel;
+	header.numChunks = numChunks;
+	header.tableChecksum = Crc32c((const uint8_t *)entries, numChunks * sizeof(RegionEntry));
+
+	memcpy(file, &header, sizeof(RegionHeader));
+	memcpy(file + sizeof(RegionHeader), entries, numChunks * sizeof(RegionEntry));
+}
+
+// Encodes chunks in the current region file format. Returns the malloc'd bytes of the whole file.
+// codec is CODEC_RLE_ZLIB or CODEC_RLE_LZ.
+uint8_t *Region_Encode(CodecContext *ctx, int lodLevel, const BlockStorage *blocks, int numChunks, ChunkCodec codec, size_t *size)
+{
+	RegionEntry *entries = calloc(numChunks, sizeof(RegionEntry));
+	uint32_t contentPos = RegionContentStart(numChunks);
+	size_t capacity = contentPos + (64 * REGION_CHUNK_ALIGNMENT);
+	uint8_t *file = malloc(capacity);
+
+	for (int i = 0; i < numChunks; i++)
+	{
+		const uint8_t *data;
+		entries[i] = EncodeChunk(ctx, blocks + i, codec, &data);
+		contentPos = AppendChunk(&file, &capacity, contentPos, entries + i, data);
+	}
+
+	WriteRegionHeader(file, lodLevel, entries, numChunks);
+	*size = contentPos;
 
-		// decode the run length, which uses a variable number of bytes
-		if (firstByte == 0xff)
+	free(entries);
+	return file;
+}
+
+typedef struct
+{
+	struct RegionEncoder *encoder;
+	SDL_Thread *thread; // NULL for the calling thread
+	CodecContext codec;
+	uint8_t *out; // stored bytes of the chunks this worker encoded, one after the other
+	size_t outSize;
+	size_t outCapacity;
+} EncoderWorker;
+
+struct RegionEncoder
+{
+	SDL_mutex *mutex;
+	SDL_cond *workCond; // signaled when a region is handed out, or the encoder shuts down
+	SDL_cond *doneCond; // signaled when the last chunk of a region is done
+	EncoderWorker workers[ENCODER_MAX_THREADS]; // the first one is the calling thread
+	int numWorkers;
+	bool alive;
+
+	// the region that is being encoded
+	const BlockStorage *blocks;
+	ChunkCodec codec;
+	int numChunks;
+	int nextChunk; // next one to hand out
+	int numDone;
+	RegionEntry entries[REGION_MAX_CHUNKS];
+	uint8_t chunkWorkers[REGION_MAX_CHUNKS]; // which worker's output has the stored bytes
+	uint32_t chunkOffsets[REGION_MAX_CHUNKS]; // where they are in it
+};
+
+// Encodes chunks of the current region until none are left to hand out. Caller must hold the mutex,
+// which is released while encoding.
+static void EncodeAvailableChunks(RegionEncoder *encoder, EncoderWorker *worker)
+{
+	int index = worker - encoder->workers;
+
+	// Chunks are taken one at a time, since a few expensive ones would otherwise keep one thread busy at the end.
+	while (encoder->nextChunk < encoder->numChunks)
+	{
+		int i = encoder->nextChunk++;
+		SDL_UnlockMutex(encoder->mutex);
+
+		const uint8_t *data;
+		RegionEntry entry = EncodeChunk(&worker->codec, encoder->blocks + i, encoder->codec, &data);
+
+		if (worker->outSize + entry.size > worker->outCapacity)
 		{
-			runLength = rle[b++];
-			runLength |= ((int)rle[b++]) << 8;
-			runLength |= ((int)rle[b++]) << 16;
-			runLength |= ((int)rle[b++]) << 24;
+			while (worker->outSize + entry.size > worker->outCapacity) worker->outCapacity *= 2;
+			worker->out = realloc(worker->out, worker->outCapacity);
 		}
-		else if (firstByte == 0)
+
+		if (entry.size > 0) memcpy(worker->out + worker->outSize, data, entry.size);
+		encoder->entries[i] = entry;
+		encoder->chunkWorkers[i] = index;
+		encoder->chunkOffsets[i] = worker->outSize;
+		worker->outSize += entry.size;
+
+		SDL_LockMutex(encoder->mutex);
+		if (++encoder->numDone == encoder->numChunks) SDL_CondSignal(encoder->doneCond);
+	}
+}
+
+// Helps with every region that is handed out, until the encoder shuts down.
+// This runs in a dedicated thread.
+static int EncoderThread(void *data)
+{
+	EncoderWorker *worker = data;
+	RegionEncoder *encoder = worker->encoder;
+	SDL_LockMutex(encoder->mutex);
+
+	while (true)
+	{
+		while (encoder->alive && encoder->nextChunk >= encoder->numChunks)
+			SDL_CondWait(encoder->workCond, encoder->mutex);
+
+		if (!encoder->alive) break;
+
+		EncodeAvailableChunks(encoder, worker);
+	}
+
+	SDL_UnlockMutex(encoder->mutex);
+	return 0;
+}
+
+// Starts an encoder that uses up to numThreads threads, including the one that calls RegionEncoder_Encode.
+RegionEncoder *RegionEncoder_New(int numThreads)
+{
+	RegionEncoder *encoder = calloc(1, sizeof(RegionEncoder));
+	if (encoder == NULL) return NULL;
+
+	if (numThreads < 1) numThreads = 1;
+	if (numThreads > ENCODER_MAX_THREADS) numThreads = ENCODER_MAX_THREADS;
+
+	encoder->mutex = SDL_CreateMutex();
+	encoder->workCond = SDL_CreateCond();
+	encoder->doneCond = SDL_CreateCond();
+	encoder->numWorkers = numThreads;
+	encoder->alive = true;
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		EncoderWorker *worker = encoder->workers + i;
+		worker->encoder = encoder;
+		CodecContext_Init(&worker->codec);
+		worker->outCapacity = 64 * REGION_CHUNK_ALIGNMENT;
+		worker->out = malloc(worker->outCapacity);
+		if (i > 0) worker->thread = SDL_CreateThread(EncoderThread, "Region Encoder Thread", worker);
+	}
+
+	return encoder;
+}
+
+void RegionEncoder_Destroy(RegionEncoder *encoder)
+{
+	if (encoder == NULL) return;
+
+	SDL_LockMutex(encoder->mutex);
+	encoder->alive = false;
+	SDL_CondBroadcast(encoder->workCond);
+	SDL_UnlockMutex(encoder->mutex);
+
+	for (int i = 0; i < encoder->numWorkers; i++)
+	{
+		EncoderWorker *worker = encoder->workers + i;
+		if (worker->thread != NULL) SDL_WaitThread(worker->thread, NULL);
+		CodecContext_Free(&worker->codec);
+		free(worker->out);
+	}
+
+	SDL_DestroyCond(encoder->workCond);
+	SDL_DestroyCond(encoder->doneCond);
+	SDL_DestroyMutex(encoder->mutex);
+	free(encoder);
+}
+
+// Does the same as Region_Encode, with the chunks spread over the encoder's threads.
+// Only one thread at a time may use an encoder.
+uint8_t *RegionEncoder_Encode(RegionEncoder *encoder, int lodLevel, const BlockStorage *blocks, int numChunks, ChunkCodec codec, size_t *size)
+{
+	SDL_LockMutex(encoder->mutex);
+
+	for (int i = 0; i < encoder->numWorkers; i++)
+		encoder->workers[i].outSize = 0;
+
+	encoder->blocks = blocks;
+	encoder->codec = codec;
+	encoder->numChunks = numChunks;
+	encoder->nextChunk = 0;
+	encoder->numDone = 0;
+	if (encoder->numWorkers > 1) SDL_CondBroadcast(encoder->workCond);
+
+	// the calling thread works too, instead of only waiting
+	EncodeAvailableChunks(encoder, encoder->workers);
+
+	while (encoder->numDone < numChunks)
+		SDL_CondWait(encoder->doneCond, encoder->mutex);
+
+	encoder->blocks = NULL;
+	SDL_UnlockMutex(encoder->mutex);
+
+	// with every chunk encoded, the file is put together in chunk order, so it is the same as Region_Encode's
+	uint32_t contentPos = RegionContentStart(numChunks);
+	size_t capacity = contentPos + (64 * REGION_CHUNK_ALIGNMENT);
+	uint8_t *file = malloc(capacity);
+
+	for (int i = 0; i < numChunks; i++)
+	{
+		const uint8_t *data = encoder->workers[encoder->chunkWorkers[i]].out + encoder->chunkOffsets[i];
+		contentPos = AppendChunk(&file, &capacity, contentPos, encoder->entries + i, data);
+	}
+
+	WriteRegionHeader(file, lodLevel, encoder->entries, numChunks);
+	*size = contentPos;
+	return file;
+}
+
+// Checks the header and table of a region file's contents. Legacy files without a header are accepted too.
+// Returns false if the contents are truncated or don't match the LOD level.
+static bool OpenContents(RegionFile *rf, char *path, int lodLevel)
+{
+	int numChunks = NumChunksInRegion(lodLevel);
+	rf->numChunks = numChunks;
+	rf->version = 0;
+	rf->table = NULL;
+
+	const RegionHeader *header = (const RegionHeader *)rf->file.data;
+
+	if (rf->file.size >= sizeof(RegionHeader) && header->magic == REGION_MAGIC)
+	{
+		size_t tableSize = numChunks * sizeof(RegionEntry);
+
+		if (header->version != REGION_VERSION || header->lodLevel != lodLevel || header->numChunks != numChunks)
 		{
-			runLength = rle[b++];
-			runLength |= ((int)rle[b++]) << 8;
+			printf("Error: Region file %s has version %d and LOD level %d.\n", path, header->version, header->lodLevel);
+			goto fail;
 		}
-		else
+
+		if (rf->file.size < sizeof(RegionHeader) + tableSize)
 		{
-			runLength = firstByte;
+			printf("Error: Region file %s is truncated.\n", path);
+			goto fail;
 		}
 
-		// decode the block type of the run
-		uint8_t runType = rle[b++];
+		rf->table = rf->file.data + sizeof(RegionHeader);
 
-		if (n >= fullSize)
+		if (Crc32c(rf->table, tableSize) != header->tableChecksum)
 		{
-			printf("Error: Too many runs in the chunk.\n");
-			break;
+			printf("Error: Region file %s has a corrupt table.\n", path);
+			goto fail;
 		}
 
-		if (n + runLength > fullSize)
-		{
-			printf("Error: A run is too long for the chunk.\n");
-			runLength = fullSize - n;
-		}
+		rf->version = REGION_VERSION;
+		return true;
+	}
 
-		// fill in the raw block data
-		memset(raw, runType, runLength);
-		raw += runLength;
-		n += runLength;
+	// legacy files start right away with 3 integers per chunk
+	if (rf->file.size < 3 * numChunks * sizeof(uint32_t))
+	{
+		printf("Error: Region file %s is truncated.\n", path);
+		goto fail;
 	}
 
-	if (b != info.numBytes)
-		printf("Error: Corrupt RLE data.\n");
+	rf->table = rf->file.data;
+	rf->version = 1;
+	return true;
+
+	fail:
+	rf->table = NULL;
+	return false;
+}
 
-	if (n < fullSize)
+// Maps a region file and checks it. Returns false if the file is missing or broken.
+bool RegionFile_Open(RegionFile *rf, char *path, int lodLevel)
+{
+	rf->mapped = File_Map(path, &rf->file);
+	if (!rf->mapped) return false;
+
+	if (OpenContents(rf, path, lodLevel)) return true;
+
+	RegionFile_Close(rf);
+	return false;
+}
+
+// Checks a region file that was already read into memory, which must stay valid until it is closed.
+// path is only used for error messages.
+bool RegionFile_OpenMemory(RegionFile *rf, const uint8_t *data, size_t size, char *path, int lodLevel)
+{
+	rf->mapped = false;
+	rf->file.data = data;
+	rf->file.size = size;
+	return OpenContents(rf, path, lodLevel);
+}
+
+void RegionFile_Close(RegionFile *rf)
+{
+	if (rf->mapped) File_Unmap(&rf->file);
+	rf->mapped = false;
+	rf->table = NULL;
+}
+
+// Returns the table entry of a chunk, converting it from the legacy layout if needed.
+static RegionEntry GetEntry(const RegionFile *rf, int index)
+{
+	RegionEntry entry = { 0 };
+
+	if (rf->version == REGION_VERSION)
 	{
-		printf("Error: Incomplete chunk.\n");
-		memset(raw, BLOCK_AIR, fullSize - n);
+		memcpy(&entry, rf->table + (index * sizeof(RegionEntry)), sizeof(RegionEntry));
+		return entry;
 	}
+
+	const uint32_t *legacy = (const uint32_t *)rf->table + (index * 3);
+	entry.offset = legacy[0];
+	entry.size = legacy[1];
+	entry.capacity = legacy[1];
+	entry.numRuns = legacy[2];
+
+	// a compressed size of 0 marks a uniform chunk, with the block type in place of the number of runs
+	entry.codec = entry.size == 0 ? CODEC_UNIFORM : CODEC_RLE_ZLIB;
+	return entry;
+}
+
+// Fills in a chunk from RLE, straight into its packed indices.
+static void DecodeRle(BlockStorage *blocks, const uint8_t *rle, int numBytes, int numRuns)
+{
+	RleInfo info;
+	info.numBytes = numBytes;
+	info.numRuns = numRuns;
+	Rle_DecodeBlocks(blocks, rle, info);
 }
 
-// Encodes block data as RLE, compresses with zlib, and writes the whole region to disk.
-void Region_Write(Region *region, char *path)
+// Decodes one chunk straight from the file contents, using its entry in the table.
+// Chunks can be read in any order, and from several threads at once as long as each has its own context.
+bool RegionFile_ReadChunk(const RegionFile *rf, int index, BlockStorage *blocks, CodecContext *ctx)
 {
-	FILE *file = fopen(path, "wb");
+	RegionEntry entry = GetEntry(rf, index);
 
-	if (file != NULL)
+	if (entry.codec == CODEC_UNIFORM)
 	{
-		int numChunks = region->numChunks;
-		uint8_t *buffer = malloc(2 * 64 * 64 * 64 * sizeof(uint8_t)); // worst case size requirement for one RLE chunk
+		Blocks_Fill(blocks, entry.numRuns);
+		return true;
+	}
 
-		// 3 integers per chunk will be written first, indicating the location of the chunk within the file,
-		// the compressed size in bytes, and the number of runs.
-		// So the first chunk contents go after those integers.
-		int contentPos = 3 * numChunks * sizeof(uint32_t);
-		int tablePos = 0;
+	if (entry.offset > rf->file.size || entry.size > rf->file.size - entry.offset)
+	{
+		printf("Error: Chunk %d is outside of the region file.\n", index);
+		return false;
+	}
 
-		for (int i = 0; i < numChunks; i++)
-		{
-			// encode chunk into buffer
-			RleInfo info = Rle_EncodeChunk(region->chunks[i].blocks, buffer);
-
-			// compress numBytes from buffer, write to file, and give me back the compressed size
-			fseek(file, contentPos, SEEK_SET);
-			int compressedSize;
-			int zres = Z_Deflate(buffer, info.numBytes, file, &compressedSize);
-			if (zres != Z_OK) break;
-
-			// write table entry for chunk
-			fseek(file, tablePos, SEEK_SET);
-			fwrite(&contentPos, sizeof(uint32_t), 1, file);
-			fwrite(&compressedSize, sizeof(uint32_t), 1, file);
-			fwrite(&(info.numRuns), sizeof(uint32_t), 1, file);
-
-			// use the size of the written data to calculate the offset for the next chunk
-			contentPos += compressedSize;
-			tablePos += 3 * sizeof(uint32_t);
-		}
+	const uint8_t *data = rf->file.data + entry.offset;
+
+	// legacy files have no checksums
+	if (rf->version == REGION_VERSION && Crc32c(data, entry.size) != entry.checksum)
+	{
+		printf("Error: Chunk %d is corrupt.\n", index);
+		return false;
+	}
+
+	switch (entry.codec)
+	{
+	case CODEC_RAW:
+		if (entry.size != BLOCKS_PER_CHUNK) break;
+		Blocks_Pack(blocks, data);
+		return true;
+
+	case CODEC_RLE:
+		DecodeRle(blocks, data, entry.size, entry.numRuns);
+		return true;
+
+	case CODEC_RLE_ZLIB:
+	{
+		// decompress and give me back the uncompressed size
+		int uncompressedSize;
+		int zres = Z_Inflate(ctx->z, data, entry.size, ctx->rle, REGION_RLE_BUFFER_SIZE, &uncompressedSize);
+		if (zres != Z_OK) break;
+
+		DecodeRle(blocks, ctx->rle, uncompressedSize, entry.numRuns);
+		return true;
+	}
 
-		fclose(file);
-		free(buffer);
+	case CODEC_RLE_LZ:
+	{
+		int uncompressedSize = Lz_Decompress(data, entry.size, ctx->rle, REGION_RLE_BUFFER_SIZE);
+		if (uncompressedSize < 0) break;
+
+		DecodeRle(blocks, ctx->rle, uncompressedSize, entry.numRuns);
+		return true;
+	}
 	}
+
+	printf("Error: Chunk %d can't be decoded.\n", index);
+	return false;
 }
 
-// Reads a region file, decompresses chunks, and decodes RLE block data.
+// Decodes a region file that was read into memory. path is only used for error messages.
 // If successful, all chunks in the region will have their block arrays filled in.
-void Region_Read(Region *region, char *path)
+void Region_ReadMemory(CodecContext *ctx, Region *region, const uint8_t *data, size_t size, char *path)
 {
-	FILE *file = fopen(path, "rb");
+	RegionFile rf;
 	bool success = false;
 
-	if (file != NULL)
+	if (RegionFile_OpenMemory(&rf, data, size, path, region->lodLevel))
 	{
-		int numChunks = region->numChunks;
-		int numLengths = 3 * numChunks;
-		int readResult;
-		uint32_t lengths[numLengths];
-		uint8_t *buffer = malloc(2 * 64 * 64 * 64 * sizeof(uint8_t)); // worst case size requirement for one RLE chunk
-
-		// read the entire metadata table at once
-		readResult = fread(lengths, sizeof(uint32_t), numLengths, file);
-		if (readResult != numLengths) { printf("Error reading file.\n"); goto f_close; }
-
 		success = true;
 
-		for (int i = 0; i < numChunks; i++)
+		for (int i = 0; i < region->numChunks && success; i++)
 		{
-			// read zlib stream from file, decompress, and give me back the uncompressed size
-			int compressedSize = lengths[(i * 3) + 1]; // second table entry (offset 1) per chunk is the compressed size
-			int uncompressedSize;
-			int zres = Z_Inflate(file, compressedSize, buffer, &uncompressedSize);
-			if (zres != Z_OK) { success = false; goto f_close; }
-
-			// decode rle to get a raw chunk
-			RleInfo info;
-			info.numBytes = uncompressedSize;
-			info.numRuns = lengths[(i * 3) + 2]; // third table entry (offset 2) is the number of runs
-			Rle_DecodeChunk(region->chunks[i].blocks, buffer, info);
+			success = RegionFile_ReadChunk(&rf, i, &region->chunks[i].blocks, ctx);
 
 			// mark chunk as loaded
-			region->chunks[i].flags |= CHUNK_LOADED | CHUNK_GENERATED;
+			if (success) region->chunks[i].flags |= CHUNK_LOADED | CHUNK_GENERATED;
 		}
 
-		f_close:
-		fclose(file);
-		free(buffer);
+		RegionFile_Close(&rf);
 	}
 
 	//printf("Loaded region (%d, %d, %d) (success = %d)\n", region->baseCoords[0], region->baseCoords[1], region->baseCoords[2], success);
 	region->loaded = success;
 }
+
+typedef struct
+{
+	RegionFileVisitor visitor;
+	void *data;
+} RegionVisit;
+
+// Reads one archived region file, and hands it to the visitor if it can be opened.
+static void VisitArchivedRegion(const ArchivedRegion *region, void *data)
+{
+	RegionVisit *visit = data;
+	FileRead read = { .path = (char *)region->path, .offset = region->offset, .size = region->size, .data = NULL };
+	ReadBatch_Read(&read, 1, READ_BACKEND_STDIO);
+
+	RegionFile rf;
+
+	if (read.data == NULL)
+	{
+		printf("Error: Could not read the L%d region at (%d, %d, %d) from %s.\n", region->lodLevel,
+			region->baseCoords[0], region->baseCoords[1], region->baseCoords[2], region->path);
+	}
+	else if (RegionFile_OpenMemory(&rf, read.data, read.size, read.path, region->lodLevel))
+	{
+		visit->visitor(&rf, region, visit->data);
+		RegionFile_Close(&rf);
+	}
+
+	ReadBatch_Free(&read, 1);
+}
+
+// Opens the region files in the archives of a set one after the other, and calls the visitor for each.
+// Returns the number of regions in the archives.
+int Region_VisitArchives(ArchiveSet *set, RegionFileVisitor visitor, void *data)
+{
+	RegionVisit visit = { visitor, data };
+	return Archive_VisitRegions(set, VisitArchivedRegion, &visit);
+}
+
+enum
+{
+	MIGRATE_BATCH = 64, // regions rewritten per archive write, which syncs once
+};
+
+typedef struct
+{
+	ArchiveSet *set;
+	CodecContext codec;
+	ArchiveWrite writes[MIGRATE_BATCH];
+	int numWrites;
+	int numRegions;
+	int numMigrated;
+} MigrationStats;
+
+// Writes the re-encoded regions to their archives.
+static void FinishMigration(MigrationStats *stats)
+{
+	Archive_WriteRegions(stats->set, stats->writes, stats->numWrites);
+
+	for (int i = 0; i < stats->numWrites; i++)
+	{
+		ArchiveWrite *write = stats->writes + i;
+
+		if (write->success) stats->numMigrated++;
+		else printf("Error: Could not migrate the L%d region at (%d, %d, %d).\n", write->lodLevel,
+			write->baseCoords[0], write->baseCoords[1], write->baseCoords[2]);
+
+		free((void *)write->data);
+	}
+
+	stats->numWrites = 0;
+}
+
+// Re-encodes an archived region in the current format if it has an older one.
+static void MigrateRegion(const RegionFile *rf, const ArchivedRegion *region, void *data)
+{
+	MigrationStats *stats = data;
+	stats->numRegions++;
+	if (rf->version == REGION_VERSION) return;
+
+	int numChunks = rf->numChunks;
+	BlockStorage *storage = calloc(numChunks, sizeof(BlockStorage));
+	bool success = true;
+
+	for (int i = 0; i < numChunks && success; i++)
+		success = RegionFile_ReadChunk(rf, i, storage + i, &stats->codec);
+
+	if (success)
+	{
+		ArchiveWrite *write = stats->writes + stats->numWrites;
+		memcpy(write->baseCoords, region->baseCoords, sizeof(ivec3));
+		write->lodLevel = region->lodLevel;
+		write->data = Region_Encode(&stats->codec, region->lodLevel, storage, numChunks, CODEC_RLE_ZLIB, &write->size);
+
+		if (++stats->numWrites == MIGRATE_BATCH) FinishMigration(stats);
+	}
+	else
+	{
+		printf("Error: Could not migrate the L%d region at (%d, %d, %d).\n", region->lodLevel,
+			region->baseCoords[0], region->baseCoords[1], region->baseCoords[2]);
+	}
+
+	for (int i = 0; i < numChunks; i++)
+		Blocks_Free(storage + i);
+
+	free(storage);
+}
+
+// Upgrades the region files of a world folder to the current format. Directories per L3 region are packed into
+// archives first, which upgrades their files, then archived regions in an older format are rewritten.
+// Returns the number of regions that were packed or rewritten.
+int Region_MigrateFolder(char *folderPath)
+{
+	int numPacked = Archive_ConvertFolder(folderPath);
+
+	MigrationStats stats = { 0 };
+	stats.set = Archive_OpenSet(folderPath);
+	CodecContext_Init(&stats.codec);
+	Region_VisitArchives(stats.set, MigrateRegion, &stats);
+	if (stats.numWrites > 0) FinishMigration(&stats);
+
+	CodecContext_Free(&stats.codec);
+	Archive_CloseSet(stats.set);
+	printf("Migrated %d of %d archived regions in %s.\n", stats.numMigrated, stats.numRegions, folderPath);
+	return numPacked + stats.numMigrated;
+}
+
+enum
+{
+	BENCH_RLE,
+	BENCH_ZLIB,
+	BENCH_LZ,
+	NUM_BENCH_CODECS,
+};
+
+typedef struct
+{
+	CodecContext codec;
+	uint8_t *decompressed;
+	uint8_t *expected;
+	BlockStorage decoded;
+	int numChunks;
+	int numErrors;
+	uint64_t storedBytes[NUM_BENCH_CODECS];
+	uint64_t encodeTicks[NUM_BENCH_CODECS];
+	uint64_t decodeTicks[NUM_BENCH_CODECS];
+} CodecBenchmark;
+
+// Encodes and decodes every chunk of a region file with each codec, timing both directions.
+// Uniform chunks are skipped, since they are stored the same way with any codec.
+static void BenchmarkRegionFile(const RegionFile *rf, const ArchivedRegion *region, void *data)
+{
+	CodecBenchmark *bench = data;
+	BlockStorage blocks = { 0 };
+
+	for (int i = 0; i < rf->numChunks; i++)
+	{
+		if (!RegionFile_ReadChunk(rf, i, &blocks, &bench->codec)) break;
+		if (Blocks_IsUniform(&blocks)) continue;
+
+		Blocks_Unpack(&blocks, bench->expected);
+		bench->numChunks++;
+
+		for (int c = 0; c < NUM_BENCH_CODECS; c++)
+		{
+			Uint64 start = SDL_GetPerformanceCounter();
+			RleInfo info = Rle_EncodeChunk(&blocks, bench->codec.rle);
+			const uint8_t *stored = bench->codec.rle;
+			int storedSize = info.numBytes;
+
+			if (c == BENCH_ZLIB)
+			{
+				Z_Deflate(bench->codec.z, bench->codec.rle, info.numBytes, bench->codec.compressed, REGION_RLE_BUFFER_SIZE, &storedSize);
+				stored = bench->codec.compressed;
+			}
+			else if (c == BENCH_LZ)
+			{
+				storedSize = Lz_Compress(bench->codec.rle, info.numBytes, bench->codec.compressed, REGION_RLE_BUFFER_SIZE);
+				stored = bench->codec.compressed;
+			}
+
+			Uint64 middle = SDL_GetPerformanceCounter();
+			const uint8_t *rle = stored;
+			int rleSize = storedSize;
+
+			if (c == BENCH_ZLIB)
+			{
+				Z_Inflate(bench->codec.z, stored, storedSize, bench->decompressed, REGION_RLE_BUFFER_SIZE, &rleSize);
+				rle = bench->decompressed;
+			}
+			else if (c == BENCH_LZ)
+			{
+				rleSize = Lz_Decompress(stored, storedSize, bench->decompressed, REGION_RLE_BUFFER_SIZE);
+				rle = bench->decompressed;
+			}
+
+			info.numBytes = rleSize;
+			Rle_DecodeBlocks(&bench->decoded, rle, info);
+			Uint64 end = SDL_GetPerformanceCounter();
+
+			Blocks_Unpack(&bench->decoded, bench->codec.raw);
+			if (memcmp(bench->codec.raw, bench->expected, BLOCKS_PER_CHUNK) != 0) bench->numErrors++;
+
+			bench->storedBytes[c] += storedSize;
+			bench->encodeTicks[c] += middle - start;
+			bench->decodeTicks[c] += end - middle;
+		}
+	}
+
+	Blocks_Free(&blocks);
+}
+
+// Prints the compression ratio and speed of each codec over the saved chunks of a world folder.
+// Speeds are in MB of raw block data per second, and include the RLE step and packing the decoded chunk.
+void Region_BenchmarkCodecs(char *folderPath)
+{
+	static const char *names[NUM_BENCH_CODECS] = { "RLE", "RLE+zlib", "RLE+LZ" };
+	CodecBenchmark bench = { 0 };
+	CodecContext_Init(&bench.codec);
+	bench.decompressed = malloc(REGION_RLE_BUFFER_SIZE);
+	bench.expected = malloc(BLOCKS_PER_CHUNK);
+
+	ArchiveSet *set = Archive_OpenSet(folderPath);
+	Region_VisitArchives(set, BenchmarkRegionFile, &bench);
+	Archive_CloseSet(set);
+
+	double rawBytes = (double)bench.numChunks * BLOCKS_PER_CHUNK;
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	printf("%d non-uniform chunks in %s, %d round trip errors\n", bench.numChunks, folderPath, bench.numErrors);
+	printf("%-10s %10s %8s %14s %14s\n", "codec", "bytes", "ratio", "encode MB/s", "decode MB/s");
+
+	for (int c = 0; c < NUM_BENCH_CODECS && bench.numChunks > 0; c++)
+	{
+		double encodeSeconds = bench.encodeTicks[c] / frequency;
+		double decodeSeconds = bench.decodeTicks[c] / frequency;
+
+		printf("%-10s %10llu %8.1f %14.1f %14.1f\n", names[c], (unsigned long long)bench.storedBytes[c],
+			rawBytes / bench.storedBytes[c], rawBytes / encodeSeconds / 1e6, rawBytes / decodeSeconds / 1e6);
+	}
+
+	Blocks_Free(&bench.decoded);
+	CodecContext_Free(&bench.codec);
+	free(bench.decompressed);
+	free(bench.expected);
+}
+
+typedef struct
+{
+	ArchivedRegion *regions;
+	int numRegions;
+	int capacity;
+	int next; // index of the next region to load
+	ReadBackend backend;
+	SDL_mutex *mutex;
+	Uint64 readTicks; // summed over all threads
+	Uint64 decodeTicks;
+	uint64_t numBytes;
+	int numErrors;
+} LoadBenchmark;
+
+static void CollectArchivedRegion(const ArchivedRegion *region, void *data)
+{
+	LoadBenchmark *bench = data;
+
+	if (bench->numRegions == bench->capacity)
+	{
+		bench->capacity = (bench->capacity * 2) + 256;
+		bench->regions = realloc(bench->regions, bench->capacity * sizeof(ArchivedRegion));
+	}
+
+	bench->regions[bench->numRegions++] = *region;
+}
+
+// Loads batches of regions like a generation thread does, until all of them are loaded.
+static int LoadBenchmarkThread(void *data)
+{
+	LoadBenchmark *bench = data;
+	CodecContext codec;
+	CodecContext_Init(&codec);
+	BlockStorage blocks = { 0 };
+
+	while (true)
+	{
+		FileRead reads[REGION_READ_BATCH];
+		int lodLevels[REGION_READ_BATCH];
+		int numReads = 0;
+
+		SDL_LockMutex(bench->mutex);
+		for (; numReads < REGION_READ_BATCH && bench->next < bench->numRegions; numReads++)
+		{
+			ArchivedRegion *region = bench->regions + bench->next++;
+			reads[numReads].path = (char *)region->path;
+			reads[numReads].offset = region->offset;
+			reads[numReads].size = region->size;
+			lodLevels[numReads] = region->lodLevel;
+		}
+		SDL_UnlockMutex(bench->mutex);
+		if (numReads == 0) break;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		ReadBatch_Read(reads, numReads, bench->backend);
+		Uint64 middle = SDL_GetPerformanceCounter();
+		uint64_t numBytes = 0;
+		int numErrors = 0;
+
+		for (int i = 0; i < numReads; i++)
+		{
+			RegionFile rf;
+			bool success = reads[i].data != NULL
+				&& RegionFile_OpenMemory(&rf, reads[i].data, reads[i].size, reads[i].path, lodLevels[i]);
+
+			for (int c = 0; success && c < rf.numChunks; c++)
+				success = RegionFile_ReadChunk(&rf, c, &blocks, &codec);
+
+			if (!success) numErrors++;
+			numBytes += reads[i].size;
+		}
+
+		Uint64 end = SDL_GetPerformanceCounter();
+		ReadBatch_Free(reads, numReads);
+
+		SDL_LockMutex(bench->mutex);
+		bench->readTicks += middle - start;
+		bench->decodeTicks += end - middle;
+		bench->numBytes += numBytes;
+		bench->numErrors += numErrors;
+		SDL_UnlockMutex(bench->mutex);
+	}
+
+	Blocks_Free(&blocks);
+	CodecContext_Free(&codec);
+	return 0;
+}
+
+// Times loading every region of a world folder from its archives with a cold page cache, once with each read backend.
+// The archives are dropped from the cache before each run, which works for files that aren't mapped or being written.
+void Region_BenchmarkLoad(char *folderPath)
+{
+	static const char *names[] = { "stdio", "io_uring" };
+	LoadBenchmark bench = { 0 };
+	bench.mutex = SDL_CreateMutex();
+	ArchiveSet *set = Archive_OpenSet(folderPath);
+	Archive_VisitRegions(set, CollectArchivedRegion, &bench);
+
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	printf("%d regions in %s, loaded with %d threads in batches of %d\n", bench.numRegions, folderPath, NUM_CHUNK_THREADS, REGION_READ_BATCH);
+	printf("%-10s %10s %10s %14s %14s %8s\n", "backend", "MB", "load ms", "read ms/thread", "decode ms/thread", "errors");
+
+	for (int b = READ_BACKEND_STDIO; b <= READ_BACKEND_URING; b++)
+	{
+		if (b == READ_BACKEND_URING && !ReadBatch_UringSupported())
+		{
+			printf("%-10s not supported\n", names[b]);
+			continue;
+		}
+
+		// the regions of an archive are visited one after the other
+		for (int i = 0; i < bench.numRegions; i++)
+			if (i == 0 || bench.regions[i].path != bench.regions[i - 1].path) File_DropCache((char *)bench.regions[i].path);
+		bench.backend = b;
+		bench.next = 0;
+		bench.readTicks = 0;
+		bench.decodeTicks = 0;
+		bench.numBytes = 0;
+		bench.numErrors = 0;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		SDL_Thread *threads[NUM_CHUNK_THREADS];
+
+		for (int i = 0; i < NUM_CHUNK_THREADS; i++)
+			threads[i] = SDL_CreateThread(LoadBenchmarkThread, "Load Benchmark Thread", &bench);
+
+		for (int i = 0; i < NUM_CHUNK_THREADS; i++)
+			SDL_WaitThread(threads[i], NULL);
+
+		double seconds = (SDL_GetPerformanceCounter() - start) / frequency;
+		printf("%-10s %10.1f %10.1f %14.1f %14.1f %8d\n", names[b], bench.numBytes / 1e6, seconds * 1e3,
+			bench.readTicks / frequency * 1e3 / NUM_CHUNK_THREADS, bench.decodeTicks / frequency * 1e3 / NUM_CHUNK_THREADS, bench.numErrors);
+	}
+
+	free(bench.regions);
+	Archive_CloseSet(set);
+	SDL_DestroyMutex(bench.mutex);
+}
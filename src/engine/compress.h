@@ -1,6 +1,99 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "world.h"
+#include "blocks.h"
+#include "filesystem.h"
+#include "zhelp.h"
+#include "archive.h"
 
-void Region_Write(Region *region, char *path);
-void Region_Read(Region *region, char *path);
+enum
+{
+	REGION_RLE_BUFFER_SIZE = 2 * BLOCKS_PER_CHUNK, // worst case size requirement for one RLE chunk
+	REGION_MAGIC = 0x47525346, // "FSRG" in little-endian byte order
+	REGION_VERSION = 2,
+	REGION_CHUNK_ALIGNMENT = 256, // chunk data is padded to this, so a chunk that shrinks or grows a little can be rewritten in place
+	REGION_MAX_CHUNKS = 512, // chunks in an L0 region
+	ENCODER_MAX_THREADS = 8,
+};
+
+// How the stored bytes of one chunk are encoded.
+typedef enum
+{
+	CODEC_RAW = 0, // BLOCKS_PER_CHUNK block types in z-order
+	CODEC_RLE = 1,
+	CODEC_RLE_ZLIB = 2,
+	CODEC_UNIFORM = 3, // nothing stored, the block type is kept in the table entry
+	CODEC_RLE_LZ = 4, // RLE compressed with the built-in LZ codec, which is much faster than zlib
+} ChunkCodec;
+
+// Version 2 region files start with a header, followed by one entry per chunk, followed by the chunk data.
+// Legacy files have no header, only 3 integers per chunk: offset, compressed size, and number of runs.
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint8_t lodLevel;
+	uint8_t reserved;
+	uint32_t numChunks;
+	uint32_t tableChecksum; // CRC32C of all the entries
+} RegionHeader;
+
+typedef struct
+{
+	uint32_t offset;
+	uint32_t size; // bytes of stored data
+	uint32_t capacity; // bytes reserved at offset, including padding
+	uint32_t checksum; // CRC32C of the stored data
+	uint32_t numRuns; // for RLE codecs, or the block type for CODEC_UNIFORM
+	uint8_t codec;
+	uint8_t reserved[3];
+} RegionEntry;
+
+// A region file in memory, for reading chunks independently of each other.
+typedef struct
+{
+	MappedFile file; // the file contents, either mapped or in memory that belongs to the caller
+	bool mapped;
+	int version; // 1 for legacy files
+	int numChunks;
+	const uint8_t *table;
+} RegionFile;
+
+// Scratch buffers and zlib streams for encoding and decoding chunks. Each thread that reads or writes regions
+// has its own, so nothing is allocated per chunk or per region.
+typedef struct
+{
+	ZContext *z;
+	uint8_t *rle; // REGION_RLE_BUFFER_SIZE bytes
+	uint8_t *compressed; // REGION_RLE_BUFFER_SIZE bytes
+	uint8_t *raw; // BLOCKS_PER_CHUNK bytes
+} CodecContext;
+
+// Encodes the chunks of a region on several threads at once.
+struct RegionEncoder;
+typedef struct RegionEncoder RegionEncoder;
+
+typedef void (*RegionFileVisitor)(const RegionFile *rf, const ArchivedRegion *region, void *data);
+
+void CodecContext_Init(CodecContext *ctx);
+void CodecContext_Free(CodecContext *ctx);
+RegionEncoder *RegionEncoder_New(int numThreads);
+void RegionEncoder_Destroy(RegionEncoder *encoder);
+uint8_t *RegionEncoder_Encode(RegionEncoder *encoder, int lodLevel, const BlockStorage *blocks, int numChunks, ChunkCodec codec, size_t *size);
+
+uint8_t *Region_Encode(CodecContext *ctx, int lodLevel, const BlockStorage *blocks, int numChunks, ChunkCodec codec, size_t *size);
+void Region_ReadMemory(CodecContext *ctx, Region *region, const uint8_t *data, size_t size, char *path);
+int Region_VisitArchives(ArchiveSet *set, RegionFileVisitor visitor, void *data);
+int Region_MigrateFolder(char *folderPath);
+void Region_BenchmarkCodecs(char *folderPath);
+void Region_BenchmarkLoad(char *folderPath);
+
+uint32_t Crc32c(const uint8_t *data, size_t size);
+
+bool RegionFile_Open(RegionFile *rf, char *path, int lodLevel);
+bool RegionFile_OpenMemory(RegionFile *rf, const uint8_t *data, size_t size, char *path, int lodLevel);
+void RegionFile_Close(RegionFile *rf);
+bool RegionFile_ReadChunk(const RegionFile *rf, int index, BlockStorage *blocks, CodecContext *ctx);
@@ -2,6 +2,9 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "filesystem.h"
 
@@ -133,3 +136,91 @@ RegFileInfo Path_GetFileInfo(char *fullPath)
 
 	return info;
 }
+
+// Calls the visitor with the full path of every regular file in a directory and its subdirectories.
+void Path_VisitFiles(char *dirPath, PathVisitor visitor, void *data)
+{
+	DIR *dir = opendir(dirPath);
+	if (dir == NULL) return;
+
+	char entryFullPath[PATH_FULLMAXLEN];
+	struct dirent *entry;
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+		Path_Combine(entryFullPath, dirPath, entry->d_name);
+
+		if (entry->d_type == DT_REG)
+			visitor(entryFullPath, data);
+		else if (entry->d_type == DT_DIR)
+			Path_VisitFiles(entryFullPath, visitor, data);
+	}
+
+	closedir(dir);
+}
+
+// Maps a whole file for reading. Returns false if it doesn't exist, is empty, or can't be mapped.
+bool File_Map(char *fullPath, MappedFile *file)
+{
+	file->data = NULL;
+	file->size = 0;
+
+	int fd = open(fullPath, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat stats;
+	void *data = MAP_FAILED;
+
+	if (fstat(fd, &stats) == 0 && stats.st_size > 0)
+		data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// the mapping stays valid after the file is closed
+	close(fd);
+	if (data == MAP_FAILED) return false;
+
+	file->data = data;
+	file->size = stats.st_size;
+	return true;
+}
+
+void File_Unmap(MappedFile *file)
+{
+	if (file->data != NULL) munmap((void *)file->data, file->size);
+	file->data = NULL;
+	file->size = 0;
+}
+
+// Flushes a file and waits until its contents are on disk.
+bool File_Sync(FILE *file)
+{
+	return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+// Waits until the entries of the directory holding a file are on disk, so a file renamed into it stays renamed.
+void Path_SyncParentDir(char *fullPath)
+{
+	char dirPath[PATH_FULLMAXLEN];
+	snprintf(dirPath, sizeof(dirPath), "%s", fullPath);
+
+	char *slash = strrchr(dirPath, '/');
+	if (slash == NULL) strcpy(dirPath, ".");
+	else *slash = '\0';
+
+	int fd = open(dirPath, O_RDONLY);
+	if (fd < 0) return;
+
+	(void)fsync(fd);
+	close(fd);
+}
+
+// Asks the system to drop a file from the page cache, so that the next read has to go to the disk.
+void File_DropCache(char *fullPath)
+{
+	int fd = open(fullPath, O_RDONLY);
+	if (fd < 0) return;
+
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
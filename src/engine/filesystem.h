@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 enum
 {
 	PATH_FULLMAXLEN = 200,
@@ -43,7 +48,22 @@ typedef struct
 	int totalSize;
 } DirInfo;
 
+typedef void (*PathVisitor)(char *fullPath, void *data);
+
+// A whole file mapped read-only into memory.
+typedef struct
+{
+	const uint8_t *data;
+	size_t size;
+} MappedFile;
+
 void Path_BuildStrAndMakeDirs(char *buffer, PathBuilder path);
 int Path_Combine(char *buffer, char *a, char *b);
 void Path_ListFiles(char *dirPath, DirInfo *dirInfo);
 RegFileInfo Path_GetFileInfo(char *fullPath);
+void Path_VisitFiles(char *dirPath, PathVisitor visitor, void *data);
+bool File_Map(char *fullPath, MappedFile *file);
+void File_Unmap(MappedFile *file);
+bool File_Sync(FILE *file);
+void Path_SyncParentDir(char *fullPath);
+void File_DropCache(char *fullPath);
@@ -73,7 +73,8 @@ static void CheckChunks(GameState* gs)
 		World_UpdatePosition(gs->world, p);
 	}
 
-	Mesher_MeshWorld(gs->world);
+	World_Update(gs->world);
+	Mesher_MeshWorld(gs->mesher);
 }
 
 GameState *Game_New(void)
@@ -94,6 +95,7 @@ GameState *Game_New(void)
 
 	// create world and game objects
 	World_Init(gs->world);
+	gs->mesher = Mesher_New(gs->world);
 	Shape *shapes = gs->render->shapes;
 	Shape_MakeSphere(shapes + 0, 3);
 	Shape_MakePlane(shapes + 1);
@@ -133,7 +135,8 @@ GameState *Game_New(void)
 
 void Game_Destroy(GameState *gs)
 {
-	gs->world->alive = false;
+	Mesher_Destroy(gs->mesher);
+	World_Destroy(gs->world);
 
 	Shape_FreeTextBox(gs->codeTextBox);
 	Shape_FreeTextBox(gs->hudTextBox);
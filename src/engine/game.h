@@ -10,6 +10,7 @@
 #include "camera.h"
 #include "shape.h"
 #include "world.h"
+#include "mesher.h"
 #include "../hardware/cpu.h"
 
 typedef struct
@@ -71,7 +72,6 @@ typedef struct
 	GLuint basicShader;
 	GLuint chunkShader;
 	GLuint chunkBAO; // block array object
-	GLuint chunkBBO; // block buffer object
 	GLuint chunkQBO; // quad buffer object
 
 	int numShapes;
@@ -84,6 +84,7 @@ typedef struct
 	RenderState *render;
 
 	World *world;
+	Mesher *mesher;
 	Model *selectedObject;
 	char *programFilePath;
 	Cpu *codeDemoCpu;
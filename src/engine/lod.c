@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include "SDL2/SDL.h"
 #include "lod.h"
+#include "compress.h"
+#include "utility.h"
 
 static inline int splitBits(int x)
 {
@@ -45,49 +49,322 @@ void SplitMortonCode(int morton, int *x, int *y, int *z)
 	*z = unsplitBits(z0);
 }
 
-// blocks should contain exactly 8 pointers in z-order to 8 block arrays representing 8 chunks,
-// and each block array should contain 64*64*64 blocks, also in z-order.
-// lod is the output, which represents all 8 chunks condensed to the size of one.
-void Lod_Generate(uint8_t **blocks, uint8_t *lod)
+// The original version of CondenseChunk, which counts every type for each group of 8 blocks.
+static void CondenseChunkScalar(const BlockStorage *blocks, uint8_t *result, uint8_t *chunk)
 {
 	const int width = 64;
 	const int width3 = width * width * width;
+
+	// A uniform chunk condenses to a uniform eighth of the result.
+	if (Blocks_IsUniform(blocks))
+	{
+		memset(result, blocks->palette[0], width3 / 8);
+		return;
+	}
+
 	int counts[256];
 	int maxCount;
 	uint8_t maxType;
-	int lodIndex = 0;
+	Blocks_Unpack(blocks, chunk);
 
-	for (int i = 0; i < 8; i++)
+	// Z-ordering makes this convenient. Just iterate over groups of 8 blocks in the current order.
+	for (int j = 0; j < width3; j += 8)
 	{
-		uint8_t *chunk = blocks[i];
+		// reset counts for each group
+		memset(counts, 0, 256 * sizeof(int));
+		maxCount = 0;
+		maxType = 0;
 
-		// Z-ordering makes this convenient. Just iterate over groups of 8 blocks in the current order.
-		for (int j = 0; j < width3; j += 8)
+		// check individual blocks in the group
+		for (int k = 0; k < 8; k++)
 		{
-			// reset counts for each group
-			memset(counts, 0, 256 * sizeof(int));
-			maxCount = 0;
-			maxType = 0;
+			uint8_t block = chunk[j + k];
+			int curCount = ++counts[block];
 
-			// check individual blocks in the group
-			for (int k = 0; k < 8; k++)
+			// non-empty blocks take priority over air
+			if (curCount > maxCount && block != 0)
 			{
-				uint8_t block = chunk[j + k];
-				int curCount = ++counts[block];
+				maxCount = curCount;
+				maxType = block;
+			}
+		}
+
+		// only choose air if more than half the blocks are air
+		if (counts[0] > 4) maxType = 0;
 
-				// non-empty blocks take priority over air
-				if (curCount > maxCount && block != 0)
+		*result++ = maxType;
+	}
+}
+
+static inline void CompareSwap(uint16_t *keys, int i, int j)
+{
+	uint16_t a = keys[i];
+	uint16_t b = keys[j];
+	keys[i] = a < b ? a : b;
+	keys[j] = a < b ? b : a;
+}
+
+// Picks the type that represents a group of 8 blocks: air if more than half of them are air, otherwise the most
+// common other type. Of the types with the most blocks, the one whose last block comes first wins,
+// because it was the first to reach that count in the original counting loop.
+static inline uint8_t CondenseGroup(const uint8_t *group)
+{
+	uint64_t word;
+	memcpy(&word, group, sizeof(word));
+
+	// most groups are all one type
+	if (word == group[0] * 0x0101010101010101ull) return group[0];
+
+	// Sorting by type, with the position below it, puts the blocks of each type next to each other, last one last.
+	uint16_t keys[9];
+	for (int k = 0; k < 8; k++)
+		keys[k] = (group[k] << 3) | k;
+
+	keys[8] = 0xffff; // ends the last type
+
+	// the 19 comparisons that sort any 8 values
+	CompareSwap(keys, 0, 2); CompareSwap(keys, 1, 3); CompareSwap(keys, 4, 6); CompareSwap(keys, 5, 7);
+	CompareSwap(keys, 0, 4); CompareSwap(keys, 1, 5); CompareSwap(keys, 2, 6); CompareSwap(keys, 3, 7);
+	CompareSwap(keys, 0, 1); CompareSwap(keys, 2, 3); CompareSwap(keys, 4, 5); CompareSwap(keys, 6, 7);
+	CompareSwap(keys, 2, 4); CompareSwap(keys, 3, 5);
+	CompareSwap(keys, 1, 4); CompareSwap(keys, 3, 6);
+	CompareSwap(keys, 1, 2); CompareSwap(keys, 3, 4); CompareSwap(keys, 5, 6);
+
+	// Each type is scored at its last block by its count, with earlier last blocks breaking ties, and the type below.
+	// Scores are masked and compared, so the loop has no branches that depend on the blocks.
+	uint32_t best = 0;
+	uint32_t runStart = 0;
+	int numAir = 0;
+
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		uint32_t type = keys[i] >> 3;
+		uint32_t last = (keys[i + 1] >> 3) != type;
+		uint32_t count = i + 1 - runStart;
+		uint32_t score = (((count << 3) | (7 - (keys[i] & 7))) << 8) | type;
+
+		score &= -(last & (type != BLOCK_AIR));
+		best = score > best ? score : best;
+		runStart = last ? i + 1 : runStart;
+		numAir += type == BLOCK_AIR;
+	}
+
+	// only choose air if more than half the blocks are air
+	return numAir > 4 ? BLOCK_AIR : (uint8_t)best;
+}
+
+// Condenses a chunk to an eighth of its size, into width3 / 8 blocks at result. chunk is scratch space for the raw blocks.
+static void CondenseChunk(const BlockStorage *blocks, uint8_t *result, uint8_t *chunk)
+{
+	const int width = 64;
+	const int width3 = width * width * width;
+
+	// A uniform chunk condenses to a uniform eighth of the result.
+	if (Blocks_IsUniform(blocks))
+	{
+		memset(result, blocks->palette[0], width3 / 8);
+		return;
+	}
+
+	Blocks_Unpack(blocks, chunk);
+
+	// Z-ordering makes this convenient. Just iterate over groups of 8 blocks in the current order.
+	for (int j = 0; j < width3; j += 8)
+		*result++ = CondenseGroup(chunk + j);
+}
+
+// blocks should contain exactly 8 pointers in z-order to the block storage of 8 chunks.
+// lod is the output, which represents all 8 chunks condensed to the size of one.
+void Lod_Generate(BlockStorage **blocks, BlockStorage *lod)
+{
+	const int width = 64;
+	const int width3 = width * width * width;
+
+	// Eight chunks of one type condense to that type without touching any block data.
+	bool same = true;
+	for (int i = 0; i < 8 && same; i++)
+		same = Blocks_IsUniform(blocks[i]) && blocks[i]->palette[0] == blocks[0]->palette[0];
+
+	if (same)
+	{
+		Blocks_Fill(lod, blocks[0]->palette[0]);
+		return;
+	}
+
+	uint8_t *chunk = malloc(width3);
+	uint8_t *result = malloc(width3);
+
+	// each chunk fills the eighth of the result at its z-order position
+	for (int i = 0; i < 8; i++)
+		CondenseChunk(blocks[i], result + (i * (width3 / 8)), chunk);
+
+	Blocks_Pack(lod, result);
+	free(chunk);
+	free(result);
+}
+
+// Like Lod_Generate, but only for the chunks that changed. Their bits are set in octants, and only their
+// pointers in blocks are used. The eighths of lod that belong to the other chunks are kept.
+void Lod_Update(BlockStorage **blocks, uint8_t octants, BlockStorage *lod)
+{
+	const int width = 64;
+	const int width3 = width * width * width;
+	uint8_t *chunk = malloc(width3);
+	uint8_t *result = malloc(width3);
+	Blocks_Unpack(lod, result);
+
+	for (int i = 0; i < 8; i++)
+		if (octants & (1 << i)) CondenseChunk(blocks[i], result + (i * (width3 / 8)), chunk);
+
+	Blocks_Pack(lod, result);
+	free(chunk);
+	free(result);
+}
+
+// The original version of Lod_Generate, kept as a reference for the benchmark.
+void Lod_GenerateScalar(BlockStorage **blocks, BlockStorage *lod)
+{
+	const int width = 64;
+	const int width3 = width * width * width;
+	uint8_t *chunk = malloc(width3);
+	uint8_t *result = malloc(width3);
+
+	for (int i = 0; i < 8; i++)
+		CondenseChunkScalar(blocks[i], result + (i * (width3 / 8)), chunk);
+
+	Blocks_Pack(lod, result);
+	free(chunk);
+	free(result);
+}
+
+typedef struct
+{
+	CodecContext codec;
+	BlockStorage children[8];
+	BlockStorage expected;
+	BlockStorage result;
+	uint8_t *raw[2]; // both results unpacked
+	int numChunks; // output chunks
+	int numErrors;
+	uint64_t scalarTicks;
+	uint64_t fastTicks;
+} LodBenchmark;
+
+// Condenses the 8 children both ways, which must give the same blocks.
+static void BenchmarkLodChunk(LodBenchmark *bench)
+{
+	BlockStorage *children[8];
+
+	for (int m = 0; m < 8; m++)
+		children[m] = bench->children + m;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	Lod_GenerateScalar(children, &bench->expected);
+	Uint64 middle = SDL_GetPerformanceCounter();
+	Lod_Generate(children, &bench->result);
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	bench->scalarTicks += middle - start;
+	bench->fastTicks += end - middle;
+	bench->numChunks++;
+
+	Blocks_Unpack(&bench->expected, bench->raw[0]);
+	Blocks_Unpack(&bench->result, bench->raw[1]);
+	if (memcmp(bench->raw[0], bench->raw[1], BLOCKS_PER_CHUNK) != 0) bench->numErrors++;
+}
+
+// Fills the children with every group of 8 blocks made of air and 3 other types, followed by random groups.
+static void BenchmarkLodSynthetic(LodBenchmark *bench)
+{
+	const int groupsPerChunk = BLOCKS_PER_CHUNK / 8;
+	srand(1);
+
+	for (int round = 0; round < 4; round++)
+	{
+		for (int m = 0; m < 8; m++)
+		{
+			for (int g = 0; g < groupsPerChunk; g++)
+			{
+				int group = (m * groupsPerChunk) + g;
+
+				for (int k = 0; k < 8; k++)
 				{
-					maxCount = curCount;
-					maxType = block;
+					// the first 4^8 groups of the first round count through all of them
+					int digit = (group >> (2 * k)) & 3;
+					uint8_t type = round == 0 && group < 65536 ? digit : rand() % (2 + (round * 3));
+					bench->codec.raw[(g * 8) + k] = type;
 				}
 			}
 
-			// only choose air if more than half the blocks are air
-			if (counts[0] > 4) maxType = 0;
+			Blocks_Pack(bench->children + m, bench->codec.raw);
+		}
 
-			// lodIndex carries over from one chunk to the next until all 8 are finished
-			lod[lodIndex++] = maxType;
+		BenchmarkLodChunk(bench);
+	}
+}
+
+static void BenchmarkLodRegionFile(const RegionFile *rf, const ArchivedRegion *region, void *data)
+{
+	LodBenchmark *bench = data;
+	if (region->lodLevel != 0) return;
+
+	for (int i = 0; i + 8 <= rf->numChunks; i += 8)
+	{
+		bool uniform = true;
+		bool success = true;
+
+		for (int m = 0; m < 8 && success; m++)
+		{
+			success = RegionFile_ReadChunk(rf, i + m, bench->children + m, &bench->codec);
+			uniform = uniform && Blocks_IsUniform(bench->children + m);
 		}
+
+		// 8 uniform chunks are condensed without looking at the blocks either way
+		if (success && !uniform) BenchmarkLodChunk(bench);
 	}
 }
+
+static void PrintLodBenchmark(LodBenchmark *bench, const char *name)
+{
+	double frequency = (double)SDL_GetPerformanceFrequency();
+	double inputBytes = (double)bench->numChunks * 8 * BLOCKS_PER_CHUNK;
+	double scalarSeconds = bench->scalarTicks / frequency;
+	double fastSeconds = bench->fastTicks / frequency;
+
+	printf("%s: %d chunks condensed, %d errors\n", name, bench->numChunks, bench->numErrors);
+	printf("  %-8s %10.1f us/chunk %10.1f MB/s\n", "counts", scalarSeconds * 1e6 / bench->numChunks, inputBytes / scalarSeconds / 1e6);
+	printf("  %-8s %10.1f us/chunk %10.1f MB/s\n", "sorting", fastSeconds * 1e6 / bench->numChunks, inputBytes / fastSeconds / 1e6);
+
+	bench->numChunks = 0;
+	bench->numErrors = 0;
+	bench->scalarTicks = 0;
+	bench->fastTicks = 0;
+}
+
+// Checks that Lod_Generate condenses chunks exactly like the original counting version, and compares their speed,
+// on every group of 8 blocks of air and 3 other types, on random blocks, and on the saved L0 regions of a world folder.
+// Speeds are in MB of finer blocks per second.
+void Lod_Benchmark(char *folderPath)
+{
+	LodBenchmark bench = { 0 };
+	CodecContext_Init(&bench.codec);
+	bench.raw[0] = malloc(BLOCKS_PER_CHUNK);
+	bench.raw[1] = malloc(BLOCKS_PER_CHUNK);
+
+	BenchmarkLodSynthetic(&bench);
+	PrintLodBenchmark(&bench, "generated chunks");
+
+	ArchiveSet *set = Archive_OpenSet(folderPath);
+	Region_VisitArchives(set, BenchmarkLodRegionFile, &bench);
+	Archive_CloseSet(set);
+	if (bench.numChunks > 0) PrintLodBenchmark(&bench, folderPath);
+
+	for (int m = 0; m < 8; m++)
+		Blocks_Free(bench.children + m);
+
+	Blocks_Free(&bench.expected);
+	Blocks_Free(&bench.result);
+	CodecContext_Free(&bench.codec);
+	free(bench.raw[0]);
+	free(bench.raw[1]);
+}
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <stdint.h>
+#include "blocks.h"
 
 int GetMortonCode(int x, int y, int z);
 void SplitMortonCode(int morton, int *x, int *y, int *z);
-void Lod_Generate(uint8_t **blocks, uint8_t *lod);
+void Lod_Generate(BlockStorage **blocks, BlockStorage *lod);
+void Lod_Update(BlockStorage **blocks, uint8_t octants, BlockStorage *lod);
+void Lod_GenerateScalar(BlockStorage **blocks, BlockStorage *lod);
+void Lod_Benchmark(char *folderPath);
@@ -0,0 +1,221 @@
+// A byte-oriented LZ77 codec in the style of LZ4, for fast region compression without another dependency.
+//
+// The data is a series of sequences. Each one starts with a token byte: the high 4 bits are the number of literals,
+// and the low 4 bits are the match length minus LZ_MIN_MATCH. A value of 15 means more length bytes follow, each
+// added to it, until one is below 255. Then come the literals, then a 2-byte little-endian offset back to the match,
+// then any extra match length bytes. The last sequence is literals only.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "lz.h"
+#include "utility.h"
+
+enum
+{
+	LZ_MIN_MATCH = 4,
+	LZ_MAX_OFFSET = 65535,
+	LZ_HASH_BITS = 14,
+	LZ_LAST_LITERALS = 5, // matches stop this far from the end, so the data always ends with literals
+	LZ_MIN_INPUT = 13, // shorter input is stored as literals only
+};
+
+static inline uint32_t Read32(const uint8_t *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t Read64(const uint8_t *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t Hash(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Counts how many bytes match, eight at a time, stopping at limit.
+static inline const uint8_t *ExtendMatch(const uint8_t *p, const uint8_t *ref, const uint8_t *limit)
+{
+	while (p + 8 <= limit)
+	{
+		uint64_t diff = Read64(p) ^ Read64(ref);
+		if (diff != 0) return p + (CountTrailingZeros64(diff) >> 3);
+		p += 8;
+		ref += 8;
+	}
+
+	while (p < limit && *p == *ref)
+	{
+		p++;
+		ref++;
+	}
+
+	return p;
+}
+
+static inline uint8_t *WriteLength(uint8_t *out, int length)
+{
+	for (; length >= 255; length -= 255)
+		*out++ = 255;
+
+	*out++ = length;
+	return out;
+}
+
+// Writes one sequence, or returns NULL if it doesn't fit before end.
+static uint8_t *WriteSequence(uint8_t *out, uint8_t *end, const uint8_t *literals, int numLiterals, int offset, int matchLength)
+{
+	// worst case: token, length bytes, literals, and offset
+	if ((end - out) < 1 + (numLiterals / 255) + 1 + numLiterals + 2 + (matchLength / 255) + 1)
+		return NULL;
+
+	uint8_t *token = out++;
+	*token = (numLiterals < 15 ? numLiterals : 15) << 4;
+	if (numLiterals >= 15) out = WriteLength(out, numLiterals - 15);
+
+	memcpy(out, literals, numLiterals);
+	out += numLiterals;
+
+	// the last sequence has no match
+	if (offset == 0) return out;
+
+	*out++ = (uint8_t)offset;
+	*out++ = (uint8_t)(offset >> 8);
+
+	matchLength -= LZ_MIN_MATCH;
+	*token |= matchLength < 15 ? matchLength : 15;
+	if (matchLength >= 15) out = WriteLength(out, matchLength - 15);
+
+	return out;
+}
+
+// Compresses bytes into a buffer. Returns the compressed size, or 0 if it doesn't fit in destSize bytes.
+int Lz_Compress(const uint8_t *source, int size, uint8_t *dest, int destSize)
+{
+	uint32_t table[1 << LZ_HASH_BITS]; // most recent position of each hashed 4-byte sequence
+	memset(table, 0, sizeof(table));
+
+	const uint8_t *in = source;
+	const uint8_t *anchor = source; // start of the pending literals
+	const uint8_t *inEnd = source + size;
+	const uint8_t *matchLimit = inEnd - LZ_LAST_LITERALS;
+	uint8_t *out = dest;
+	uint8_t *outEnd = dest + destSize;
+
+	if (size >= LZ_MIN_INPUT)
+	{
+		// a match needs 4 bytes to hash, and has to leave the last literals alone
+		const uint8_t *searchLimit = inEnd - LZ_MIN_INPUT + 1;
+
+		while (in < searchLimit)
+		{
+			uint32_t sequence = Read32(in);
+			uint32_t h = Hash(sequence);
+			const uint8_t *ref = source + table[h];
+			table[h] = in - source;
+
+			if (ref >= in || in - ref > LZ_MAX_OFFSET || Read32(ref) != sequence)
+			{
+				// step further the longer nothing matches, since incompressible data won't start matching soon
+				in += 1 + ((in - anchor) >> 6);
+				continue;
+			}
+
+			// grow the match backwards into the literals
+			while (in > anchor && ref > source && in[-1] == ref[-1])
+			{
+				in--;
+				ref--;
+			}
+
+			const uint8_t *matchEnd = ExtendMatch(in + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, matchLimit);
+			out = WriteSequence(out, outEnd, anchor, in - anchor, in - ref, matchEnd - in);
+			if (out == NULL) return 0;
+
+			in = anchor = matchEnd;
+
+			// remember a position inside the match, which helps with runs
+			if (in - 2 > source) table[Hash(Read32(in - 2))] = (in - 2) - source;
+		}
+	}
+
+	out = WriteSequence(out, outEnd, anchor, inEnd - anchor, 0, 0);
+	if (out == NULL) return 0;
+
+	return out - dest;
+}
+
+// Reads an extra length: bytes are added until one is below 255. Returns false if the data ends first.
+static inline bool ReadLength(const uint8_t **in, const uint8_t *inEnd, size_t *length)
+{
+	uint8_t byte;
+
+	do {
+		if (*in >= inEnd) return false;
+		byte = *(*in)++;
+		*length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+// Decompresses into a buffer. Returns the decompressed size, or -1 if the data is corrupt or doesn't fit in destSize bytes.
+int Lz_Decompress(const uint8_t *source, int compressedSize, uint8_t *dest, int destSize)
+{
+	const uint8_t *in = source;
+	const uint8_t *inEnd = source + compressedSize;
+	uint8_t *out = dest;
+	uint8_t *outEnd = dest + destSize;
+
+	while (in < inEnd)
+	{
+		uint8_t token = *in++;
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !ReadLength(&in, inEnd, &numLiterals)) return -1;
+		if (numLiterals > (size_t)(inEnd - in) || numLiterals > (size_t)(outEnd - out)) return -1;
+
+		memcpy(out, in, numLiterals);
+		out += numLiterals;
+		in += numLiterals;
+
+		// the last sequence has no match
+		if (in == inEnd) break;
+		if (inEnd - in < 2) return -1;
+
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if (offset == 0 || offset > (size_t)(out - dest)) return -1;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !ReadLength(&in, inEnd, &matchLength)) return -1;
+		matchLength += LZ_MIN_MATCH;
+		if (matchLength > (size_t)(outEnd - out)) return -1;
+
+		const uint8_t *ref = out - offset;
+
+		if (offset >= 8 && matchLength + 8 <= (size_t)(outEnd - out))
+		{
+			// Copies 8 bytes at a time. It can write up to 7 bytes past the match, but those are still inside dest.
+			for (size_t i = 0; i < matchLength; i += 8)
+				memcpy(out + i, ref + i, 8);
+		}
+		else
+		{
+			// A short offset means the match overlaps its own output, as in a run of one repeated byte.
+			// Near the end of dest there is no room for whole 8-byte copies either.
+			for (size_t i = 0; i < matchLength; i++)
+				out[i] = ref[i];
+		}
+
+		out += matchLength;
+	}
+
+	return out - dest;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+int Lz_Compress(const uint8_t *source, int size, uint8_t *dest, int destSize);
+int Lz_Decompress(const uint8_t *source, int compressedSize, uint8_t *dest, int destSize);
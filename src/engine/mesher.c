@@ -4,6 +4,7 @@
 #endif
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -16,6 +17,75 @@
 #include "mesher.h"
 #include "lod.h"
 #include "world.h"
+#include "compress.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MESHER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(MESHER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define MESHER_AVX2
+#include <immintrin.h>
+#endif
+
+enum
+{
+	NUM_MESH_THREADS = 4,
+	MESH_RESULTS_PER_FRAME = 64, // how many finished meshes the main thread swaps in per frame
+	MESH_CACHE_SIZE = 8, // how many edited chunks keep their masks for patching
+	NUM_SLICES = 6 * 64, // quads are grouped by direction and column
+};
+
+// Masks kept for a recently edited chunk, so that block edits only re-mesh the slices they touch.
+// A slice is the quads of one direction and column. Greedy meshing never merges faces across slices.
+typedef struct
+{
+	Chunk* chunk; // pinned with meshRefs while cached
+	unsigned int version; // chunk->version that the masks match, before chunk->edits are applied
+	uint64_t lastUsed;
+	uint32_t sliceStart[NUM_SLICES + 1]; // where each slice starts in chunk->quads
+	uint64_t boundary[6 * 64];
+	uint64_t occupancy[3 * 64 * 64];
+	uint64_t faces[6 * 64 * 64]; // indexed by direction, column, then plane, with a bit per row
+} MeshCache;
+
+typedef struct
+{
+	Chunk* chunk;
+	unsigned int version; // chunk->version when the job was queued
+	ListUInt64 quads;
+	MeshCache* cache; // filled in along with the quads for edited chunks, otherwise NULL
+
+	// Loaded chunks bordering each side: one at the same or the next coarser LOD level,
+	// or four at the next finer level. neighborLods is -1 for sides without loaded neighbors.
+	Chunk* neighbors[6][4];
+	int8_t neighborLods[6];
+} MeshJob;
+
+// Working memory for meshing one chunk. Each mesher thread reuses its own across chunks.
+typedef struct
+{
+	uint64_t occupancy[3 * 64 * 64]; // 96 kB
+	uint64_t faceMasks[6 * 64 * 64]; // 192 kB
+	uint64_t boundary[6 * 64];
+	uint64_t columns[64 * 64]; // face masks of one direction, transposed for GreedyMesh
+	uint8_t blocks[BLOCKS_PER_CHUNK]; // block types of the chunk, unpacked from its storage
+} MeshScratch;
+
+struct Mesher
+{
+	World* world;
+	SDL_mutex* mutex;
+	SDL_cond* jobCond;
+	SDL_Thread* threads[NUM_MESH_THREADS];
+	ListUInt64 jobs; // queued MeshJob pointers, nearest chunk last
+	ListUInt64 results; // finished MeshJob pointers
+	bool alive;
+	bool useAvx2;
+	MeshCache* caches[MESH_CACHE_SIZE]; // only touched by the main thread
+	uint64_t frame;
+};
 
 // Indexes an occupancy mask by plane and row.
 // Returns an int representing the row, where each bit indicates the presence of a block in the corresponding column.
@@ -26,39 +96,135 @@ static inline const uint64_t GetOccupancy(uint64_t* occupancy, Axis axis, int pl
 	return occupancy[(axis * 4096) + (plane * 64) + row];
 }
 
-// Sets the occupancy flag at the given coordinates.
-static inline void SetOccupancy(uint64_t* occupancy, Axis axis, int plane, int row, int column)
+// Transposes a 64x64 bit matrix in place, so that bit c of rows[r] moves to bit r of rows[c].
+static void TransposeBits64(uint64_t* rows)
 {
-	occupancy[(axis * 4096) + (plane * 64) + row] |= (1ull << column);
+	uint64_t mask = 0x00000000ffffffffull;
+
+	for (int j = 32; j != 0; j >>= 1, mask ^= mask << j)
+	{
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j)
+		{
+			uint64_t t = ((rows[k] >> j) ^ rows[k | j]) & mask;
+			rows[k] ^= t << j;
+			rows[k | j] ^= t;
+		}
+	}
 }
 
-static bool GenerateOccupancyMasks(Chunk* chunk)
+// Returns a mask of the 64 blocks starting at blocks, with a bit set for each block that is not air.
+static inline uint64_t SolidMask64(const uint8_t* blocks)
 {
-	bool anyBlocks = false;
+#ifdef MESHER_SSE2
+	__m128i zero = _mm_setzero_si128();
+	uint64_t air = 0;
 
-	// load occupancy data from raw chunk
-	for (int z = 0; z < 64; z++)
+	for (int i = 0; i < 4; i++)
 	{
-		for (int y = 0; y < 64; y++)
+		__m128i v = _mm_loadu_si128((const __m128i*)(blocks + (i * 16)));
+		air |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << (i * 16);
+	}
+
+	return ~air;
+#else
+	uint64_t solid = 0;
+
+	for (int i = 0; i < 64; i++)
+		solid |= (uint64_t)(blocks[i] != 0) << i;
+
+	return solid;
+#endif
+}
+
+#ifdef MESHER_AVX2
+__attribute__((target("avx2")))
+static uint64_t SolidMask64Avx2(const uint8_t* blocks)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_loadu_si256((const __m256i*)blocks);
+	__m256i hi = _mm256_loadu_si256((const __m256i*)(blocks + 32));
+	uint64_t air = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero));
+	air |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)) << 32;
+	return ~air;
+}
+#endif
+
+// Swaps the bits selected by mask with the bits delta places above them.
+static inline uint64_t DeltaSwap(uint64_t x, uint64_t mask, int delta)
+{
+	uint64_t t = ((x >> delta) ^ x) & mask;
+	return x ^ t ^ (t << delta);
+}
+
+// Builds the x occupancy mask, then derives the y and z masks from it with bit transposes.
+// Every row is written, so the masks don't need clearing.
+static bool GenerateOccupancyMasks(const uint8_t* blocks, uint64_t* occupancy, bool useAvx2)
+{
+	uint64_t* xMask = occupancy;
+	uint64_t* yMask = occupancy + (AXIS_Y * 4096);
+	uint64_t* zMask = occupancy + (AXIS_Z * 4096);
+	uint64_t anyBlocks = 0;
+
+	// Each run of 64 blocks in z-order is a 4x4x4 cube. Its rows along x are spread out in the Morton code,
+	// so the bits are first shuffled into x + 4y + 16z order, leaving one 4-bit row per nibble.
+	for (int gz = 0; gz < 16; gz++)
+	{
+		for (int gy = 0; gy < 16; gy++)
 		{
-			for (int x = 0; x < 64; x++)
+			uint64_t rows[16] = { 0 }; // indexed by y + 4z within the cubes
+
+			for (int gx = 0; gx < 16; gx++)
 			{
-				int m = GetMortonCode(x, y, z);
-				uint8_t blockType = chunk->blocks[m];
+				const uint8_t* cube = blocks + (GetMortonCode(gx, gy, gz) << 6);
+				uint64_t solid;
 
-				if (blockType != 0)
-				{
-					// add the block to the occupancy masks
-					SetOccupancy(chunk->occupancy, 0, z, y, x);
-					SetOccupancy(chunk->occupancy, 1, z, x, y);
-					SetOccupancy(chunk->occupancy, 2, y, x, z);
-					anyBlocks = true;
-				}
+#ifdef MESHER_AVX2
+				solid = useAvx2 ? SolidMask64Avx2(cube) : SolidMask64(cube);
+#else
+				solid = SolidMask64(cube);
+#endif
+
+				if (solid == 0) continue;
+				anyBlocks |= solid;
+
+				// x0 y0 z0 x1 y1 z1 -> x0 x1 y0 y1 z0 z1
+				solid = DeltaSwap(solid, 0x00cc00cc00cc00ccull, 6);
+				solid = DeltaSwap(solid, 0x00f000f000f000f0ull, 4);
+				solid = DeltaSwap(solid, 0x0000ff000000ff00ull, 8);
+
+				for (int i = 0; i < 16; i++)
+					rows[i] |= ((solid >> (i * 4)) & 0xf) << (gx * 4);
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				int y = (gy * 4) + (i & 3);
+				int z = (gz * 4) + (i >> 2);
+				xMask[(z * 64) + y] = rows[i];
 			}
 		}
 	}
 
-	return anyBlocks;
+	if (anyBlocks == 0) return false;
+
+	for (int z = 0; z < 64; z++)
+	{
+		// plane z of the x mask has rows along y with bits along x, and the y mask wants the opposite
+		memcpy(yMask + (z * 64), xMask + (z * 64), 64 * sizeof(uint64_t));
+		TransposeBits64(yMask + (z * 64));
+	}
+
+	for (int y = 0; y < 64; y++)
+	{
+		uint64_t* rows = zMask + (y * 64);
+
+		for (int z = 0; z < 64; z++)
+			rows[z] = xMask[(z * 64) + y];
+
+		TransposeBits64(rows);
+	}
+
+	return true;
 }
 
 static inline const uint64_t LeftFaces(uint64_t blocks, bool prev)
@@ -83,21 +249,11 @@ static inline const uint64_t RightFaces(uint64_t blocks, bool next)
 	return rightFaces;
 }
 
-static inline const bool GetFace(uint64_t* faceMasks, int dir, int plane, int row, int column)
-{
-	return 0 != (faceMasks[(dir * 4096) + (plane * 64) + row] & (1ull << column));
-}
-
 static inline void SetFaces(uint64_t* faceMasks, int dir, int plane, int row, uint64_t mask)
 {
 	faceMasks[(dir * 4096) + (plane * 64) + row] = mask;
 }
 
-static inline void ClearOneFace(uint64_t* faceMasks, int dir, int plane, int row, int column)
-{
-	faceMasks[(dir * 4096) + (plane * 64) + row] &= ~(1ull << column);
-}
-
 static void CalculateFaces(uint64_t* faceMasks, uint64_t blocks, Axis axis, int plane, int row, bool prevBlock, bool nextBlock)
 {
 	uint64_t posFaces = RightFaces(blocks, nextBlock);
@@ -121,6 +277,7 @@ static inline void ConvertAxisCoords(ivec3 coords, Axis axis, int column, int ro
 		coords[2] = plane;
 		break;
 	case AXIS_Z:
+	default:
 		coords[0] = row;
 		coords[1] = plane;
 		coords[2] = column;
@@ -128,51 +285,298 @@ static inline void ConvertAxisCoords(ivec3 coords, Axis axis, int column, int ro
 	}
 }
 
-static void CalculateFacesForAxis(Chunk* chunk, World* world, Axis axis, int plane, int row)
+// boundary holds six masks (one per side, indexed like face directions) of 64 rows per plane.
+// A set bit means the neighboring chunk has a block right outside that row.
+// Both face rows are always written, even when empty, so the face masks never need clearing.
+static void CalculateFacesForAxis(MeshScratch* scratch, Axis axis, int plane, int row)
 {
-	uint64_t blocks = GetOccupancy(chunk->occupancy, axis, plane, row);
-	if (blocks == 0) return;
+	uint64_t* boundary = scratch->boundary;
+	uint64_t blocks = GetOccupancy(scratch->occupancy, axis, plane, row);
 
-	// TODO: determine whether the faces at the chunk boundaries are exposed
-	bool prevBlock = false;
-	bool nextBlock = false;
+	// prevBlock is the block past column 63, and nextBlock is the one before column 0
+	bool prevBlock = (boundary[(((2 * axis) + 1) * 64) + plane] >> row) & 1;
+	bool nextBlock = (boundary[((2 * axis) * 64) + plane] >> row) & 1;
 
-	CalculateFaces(chunk->faceMasks, blocks, axis, plane, row, prevBlock, nextBlock);
+	CalculateFaces(scratch->faceMasks, blocks, axis, plane, row, prevBlock, nextBlock);
 }
 
 // uses binary operations to find exposed faces
-static void GenerateFaceMasks(Chunk* chunk, World* world)
+static void GenerateFaceMasks(MeshScratch* scratch)
 {
 	for (int z = 0; z < 64; z++)
 	{
 		for (int y = 0; y < 64; y++)
-			CalculateFacesForAxis(chunk, world, AXIS_X, z, y);
+			CalculateFacesForAxis(scratch, AXIS_X, z, y);
 
 		for (int x = 0; x < 64; x++)
-			CalculateFacesForAxis(chunk, world, AXIS_Y, z, x);
+			CalculateFacesForAxis(scratch, AXIS_Y, z, x);
 	}
 
 	for (int y = 0; y < 64; y++)
 		for (int x = 0; x < 64; x++)
-			CalculateFacesForAxis(chunk, world, AXIS_Z, y, x);
+			CalculateFacesForAxis(scratch, AXIS_Z, y, x);
+}
+
+// Axes of the plane and row for each occupancy axis, matching ConvertAxisCoords.
+static const int planeAxes[3] = { AXIS_Z, AXIS_Z, AXIS_Y };
+static const int rowAxes[3] = { AXIS_Y, AXIS_X, AXIS_X };
+
+// Checks for a block in a neighbor chunk. The position is in L0 blocks relative to the origin of chunk.
+static inline bool IsNeighborBlockSolid(Chunk* chunk, Chunk* neighbor, ivec3 pos)
+{
+	int local[3];
+
+	for (int a = 0; a < 3; a++)
+	{
+		local[a] = (((chunk->coords[a] - neighbor->coords[a]) * 64) + pos[a]) >> neighbor->lodLevel;
+		if (local[a] < 0 || local[a] > 63) return false;
+	}
+
+	return Blocks_Get(&neighbor->blocks, GetMortonCode(local[0], local[1], local[2])) != 0;
+}
+
+// Fills in the boundary mask for one side from the neighbor chunks found by FindNeighbors.
+// A face of a coarser neighbor covers several of ours, while a finer neighbor only hides a face if it fills the whole face.
+// The meshes of two LOD levels don't share vertices, which leaves cracks along the seam where the surface crosses it.
+// So across a change of level, a covered face is only culled if the faces around it are covered too. The faces next to
+// an exposed one stay as skirts that fill the cracks with a wall, while buried walls are still culled.
+static void GenerateBoundaryMask(MeshJob* job, int side, uint64_t* mask)
+{
+	Chunk* chunk = job->chunk;
+	int neighborLod = job->neighborLods[side];
+	memset(mask, 0, 64 * sizeof(uint64_t));
+	if (neighborLod < 0) return;
+
+	Axis axis = side / 2;
+	int pAxis = planeAxes[axis];
+	int rAxis = rowAxes[axis];
+	int scale = 1 << chunk->lodLevel; // size of our voxels in L0 blocks
+	int half = scale / 2;
+	bool finer = neighborLod < chunk->lodLevel;
+	ivec3 pos;
+
+	// just outside the chunk, on the side in question
+	pos[axis] = (side % 2) ? 64 * scale : -1;
+
+	// Each quarter of the side is covered by one neighbor, whose block data is locked while it is sampled.
+	for (int q = 0; q < 4; q++)
+	{
+		Chunk* neighbor = job->neighbors[side][finer ? q : 0];
+		int planeStart = (q >> 1) * 32;
+		int rowStart = (q & 1) * 32;
+		SDL_LockMutex(neighbor->mutex);
+
+		for (int plane = planeStart; plane < planeStart + 32; plane++)
+		{
+			for (int row = rowStart; row < rowStart + 32; row++)
+			{
+				pos[pAxis] = plane * scale;
+				pos[rAxis] = row * scale;
+				bool solid;
+
+				if (!finer)
+				{
+					solid = IsNeighborBlockSolid(chunk, neighbor, pos);
+				}
+				else
+				{
+					// check the four finer blocks that touch this face
+					solid = true;
+
+					for (int i = 0; i < 4 && solid; i++)
+					{
+						pos[pAxis] = plane * scale + (i >> 1) * half;
+						pos[rAxis] = row * scale + (i & 1) * half;
+						solid = IsNeighborBlockSolid(chunk, neighbor, pos);
+					}
+				}
+
+				if (solid) mask[plane] |= 1ull << row;
+			}
+		}
+
+		SDL_UnlockMutex(neighbor->mutex);
+	}
+
+	if (neighborLod == chunk->lodLevel) return;
+
+	uint64_t covered[64];
+	memcpy(covered, mask, sizeof(covered));
+
+	// faces beyond the edges of the side are left to the chunks there, so they count as covered
+	for (int plane = 0; plane < 64; plane++)
+	{
+		mask[plane] &= (covered[plane] << 1) | 1;
+		mask[plane] &= (covered[plane] >> 1) | (1ull << 63);
+		if (plane > 0) mask[plane] &= covered[plane - 1];
+		if (plane < 63) mask[plane] &= covered[plane + 1];
+	}
+}
+
+// Looks for loaded active chunks across one side of the chunk. Returns their LOD level, or -1 if none.
+// Active chunks never overlap, so the neighbor is either one chunk at the same or the next coarser level,
+// or four chunks at the next finer level.
+static int FindNeighbors(World* world, Chunk* chunk, int side, Chunk** neighbors)
+{
+	Axis axis = side / 2;
+	int pAxis = planeAxes[axis];
+	int rAxis = rowAxes[axis];
+	int lod = chunk->lodLevel;
+	int step = 1 << lod;
+	bool positive = side % 2;
+	ivec3 n;
+
+	glm_ivec3_copy(chunk->coords, n);
+	n[axis] += positive ? step : -step;
+
+	Chunk* c = World_GetActiveChunk(world, n, lod);
+	if (c != NULL)
+	{
+		neighbors[0] = c;
+		return EnumHasFlag(c->flags, CHUNK_LOADED) ? lod : -1;
+	}
+
+	// align to the coarser grid
+	ivec3 coarse;
+	glm_ivec3_copy(n, coarse);
+	for (int a = 0; a < 3; a++) coarse[a] -= ((coarse[a] % (2 * step)) + (2 * step)) % (2 * step);
+
+	c = World_GetActiveChunk(world, coarse, lod + 1);
+	if (c != NULL)
+	{
+		neighbors[0] = c;
+		return EnumHasFlag(c->flags, CHUNK_LOADED) ? lod + 1 : -1;
+	}
+
+	if (lod == 0) return -1;
+
+	int half = step / 2;
+	if (!positive) n[axis] = chunk->coords[axis] - half;
+
+	for (int i = 0; i < 4; i++)
+	{
+		ivec3 f;
+		glm_ivec3_copy(n, f);
+		f[pAxis] += (i >> 1) * half;
+		f[rAxis] += (i & 1) * half;
+
+		c = World_GetActiveChunk(world, f, lod - 1);
+		if (c == NULL || !EnumHasFlag(c->flags, CHUNK_LOADED)) return -1;
+		neighbors[i] = c;
+	}
+
+	return lod - 1;
+}
+
+static inline int NumNeighbors(MeshJob* job, int side)
+{
+	if (job->neighborLods[side] < 0) return 0;
+	return job->neighborLods[side] < job->chunk->lodLevel ? 4 : 1;
+}
+
+// x axis (dir 0/1): z -> plane, y -> row, x -> column
+// y axis (dir 2/3): z, x, y
+// z axis (dir 4/5): y, x, z
+// Meshes one slice from its faces, given as a bit per row for each plane. The faces are used up in the process.
+static void GreedyMeshSlice(uint64_t* planes, int dir, int column, ListUInt64* quadList)
+{
+	Axis axis = dir / 2;
+
+	// Runs of faces across rows are found a word at a time,
+	// then grown across planes for as long as the next plane has the whole run.
+	for (int plane = 0; plane < 64; plane++)
+	{
+		uint64_t faces = planes[plane];
+
+		while (faces != 0)
+		{
+			int quadStartRow = CountTrailingZeros64(faces);
+			uint64_t run = faces >> quadStartRow;
+			int runLength = (~run == 0) ? 64 : CountTrailingZeros64(~run);
+			uint64_t runMask = (runLength == 64 ? ~0ull : ((1ull << runLength) - 1)) << quadStartRow;
+			faces &= ~runMask;
+
+			int quadEndPlane = plane;
+			while (quadEndPlane < 63 && (planes[quadEndPlane + 1] & runMask) == runMask)
+			{
+				quadEndPlane++;
+				planes[quadEndPlane] &= ~runMask;
+			}
+
+			// construct a rectangle
+			ivec3 coords;
+			ConvertAxisCoords(coords, axis, column, quadStartRow, plane);
+			uint64_t height = runLength - 1;
+			uint64_t width = quadEndPlane - plane;
+			uint64_t quad = (((uint64_t)dir) << 61) | (height << 38) | (width << 32) | (coords[2] << 12) | (coords[1] << 6) | coords[0];
+			ListUInt64Insert(quadList, quad);
+		}
+	}
 }
 
 // x axis (dir 0/1): z -> plane, y -> row, x -> column
 // y axis (dir 2/3): z, x, y
 // z axis (dir 4/5): y, x, z
-static void GreedyMesh(Chunk* chunk)
+// If cache is given, the transposed faces and the start of each slice are saved in it.
+static void GreedyMesh(MeshScratch* scratch, ListUInt64* quadList, MeshCache* cache)
 {
-	uint64_t* faceMasks = chunk->faceMasks;
-	ListUInt64* quadList = &chunk->quads;
+	uint64_t* faceMasks = scratch->faceMasks;
 	quadList->size = 0; // reset list
 
+	// Face masks for one direction, transposed so that each word holds the rows of one column in one plane.
+	// Indexed by column, then plane.
+	uint64_t* columns = scratch->columns;
+
+	for (int dir = 0; dir < 6; dir++)
+	{
+		uint64_t anyFaces = 0;
+
+		for (int plane = 0; plane < 64; plane++)
+		{
+			uint64_t rows[64];
+			memcpy(rows, faceMasks + (dir * 4096) + (plane * 64), sizeof(rows));
+			TransposeBits64(rows);
+
+			for (int column = 0; column < 64; column++)
+			{
+				columns[(column * 64) + plane] = rows[column];
+				anyFaces |= rows[column];
+			}
+		}
+
+		if (cache != NULL)
+			memcpy(cache->faces + (dir * 4096), columns, 4096 * sizeof(uint64_t));
+
+		for (int column = 0; column < 64; column++)
+		{
+			if (cache != NULL) cache->sliceStart[(dir * 64) + column] = quadList->size;
+			if (anyFaces != 0) GreedyMeshSlice(columns + (column * 64), dir, column, quadList);
+		}
+	}
+
+	if (cache != NULL) cache->sliceStart[NUM_SLICES] = quadList->size;
+}
+
+static inline bool GetFace(uint64_t* faceMasks, int dir, int plane, int row, int column)
+{
+	return 0 != (faceMasks[(dir * 4096) + (plane * 64) + row] & (1ull << column));
+}
+
+static inline void ClearOneFace(uint64_t* faceMasks, int dir, int plane, int row, int column)
+{
+	faceMasks[(dir * 4096) + (plane * 64) + row] &= ~(1ull << column);
+}
+
+// The original greedy mesher, which looks at one face at a time, kept as a reference for the benchmark.
+// It gives the same quads in the same order as GreedyMesh, but uses up the face masks.
+static void GreedyMeshScalar(uint64_t* faceMasks, ListUInt64* quadList)
+{
+	quadList->size = 0;
+
 	for (int dir = 0; dir < 6; dir++)
 	{
 		Axis axis = dir / 2;
 
-		// The column is a bit position in an int64_t, which indicates where faces are.
-		// Inner loops will iterate over planes and rows while a column is held constant.
-		// That's how adjacent faces are found.
 		for (int column = 0; column < 64; column++)
 		{
 			for (int plane = 0; plane < 64; plane++)
@@ -182,31 +586,21 @@ static void GreedyMesh(Chunk* chunk)
 					int quadStartRow = -1;
 					int quadEndRow = -1;
 					int quadEndPlane = plane;
-					bool face = false;
-					bool foundFace = false;
 
 					// search for one or more contiguous faces, across rows, in the same column
 					for (; row < 64; row++)
 					{
-						face = GetFace(faceMasks, dir, plane, row, column);
+						bool face = GetFace(faceMasks, dir, plane, row, column);
 
-						if (foundFace)
+						if (quadStartRow >= 0)
 						{
-							if (face)
-							{
-								quadEndRow++;
-								//ClearOneFace(faceMasks, dir, plane, row, column);
-							}
+							if (face) quadEndRow++;
 							else break;
 						}
-						else
+						else if (face)
 						{
-							if (face)
-							{
-								quadStartRow = row;
-								quadEndRow = quadStartRow;
-								foundFace = true;
-							}
+							quadStartRow = row;
+							quadEndRow = row;
 						}
 					}
 
@@ -218,25 +612,14 @@ static void GreedyMesh(Chunk* chunk)
 					{
 						bool planeOk = true;
 
-						for (int r = quadStartRow; r <= quadEndRow; r++)
-						{
-							if (!GetFace(faceMasks, dir, p, r, column))
-							{
-								planeOk = false;
-								break;
-							}
-						}
+						for (int r = quadStartRow; r <= quadEndRow && planeOk; r++)
+							planeOk = GetFace(faceMasks, dir, p, r, column);
 
-						if (planeOk)
-						{
-							quadEndPlane++;
+						if (!planeOk) break;
+						quadEndPlane++;
 
-							for (int r = quadStartRow; r <= quadEndRow; r++)
-							{
-								ClearOneFace(faceMasks, dir, p, r, column);
-							}
-						}
-						else break;
+						for (int r = quadStartRow; r <= quadEndRow; r++)
+							ClearOneFace(faceMasks, dir, p, r, column);
 					}
 
 					// construct a rectangle
@@ -252,61 +635,645 @@ static void GreedyMesh(Chunk* chunk)
 	}
 }
 
-void Mesher_MeshWorld(World* world)
+// Builds the quads for one chunk into the job's own list. The chunk's current quads are left alone.
+static void MeshChunk(MeshJob* job, MeshScratch* scratch, bool useAvx2)
 {
-	SDL_LockMutex(world->mutex);
-	if (!world->dirty)
+	Chunk* chunk = job->chunk;
+	MeshCache* cache = job->cache;
+	job->quads.size = 0;
+
+	// The main thread can change the block data with World_SetBlock, so take a copy.
+	SDL_LockMutex(chunk->mutex);
+	bool uniform = Blocks_IsUniform(&chunk->blocks);
+	bool empty = uniform && chunk->blocks.palette[0] == BLOCK_AIR;
+	bool sidesOnly = uniform && !empty && cache == NULL;
+	if (!empty && !sidesOnly) Blocks_Unpack(&chunk->blocks, scratch->blocks);
+	SDL_UnlockMutex(chunk->mutex);
+
+	// A chunk full of one solid type only has faces on its sides, where the neighbor leaves them exposed.
+	if (sidesOnly)
 	{
-		SDL_UnlockMutex(world->mutex);
+		for (int side = 0; side < 6; side++)
+		{
+			uint64_t* boundary = scratch->boundary + (side * 64);
+			GenerateBoundaryMask(job, side, boundary);
+
+			uint64_t planes[64];
+			for (int plane = 0; plane < 64; plane++)
+				planes[plane] = ~boundary[plane];
+
+			// positive sides face out of the last column
+			GreedyMeshSlice(planes, side, (side % 2) ? 63 : 0, &job->quads);
+		}
+
 		return;
 	}
 
-	const size_t sizeOfMaskArrays = 64 * 64 * sizeof(uint64_t);
-	Uint32 ticks = SDL_GetTicks();
+	bool anyBlocks = !empty && GenerateOccupancyMasks(scratch->blocks, scratch->occupancy, useAvx2);
+	if (!anyBlocks && cache == NULL) return;
+
+	for (int side = 0; side < 6; side++)
+		GenerateBoundaryMask(job, side, scratch->boundary + (side * 64));
+
+	if (anyBlocks)
+	{
+		GenerateFaceMasks(scratch);
+		GreedyMesh(scratch, &job->quads, cache);
+	}
+
+	if (cache != NULL)
+	{
+		memcpy(cache->boundary, scratch->boundary, sizeof(cache->boundary));
+
+		if (anyBlocks)
+		{
+			memcpy(cache->occupancy, scratch->occupancy, sizeof(cache->occupancy));
+		}
+		else
+		{
+			memset(cache->occupancy, 0, sizeof(cache->occupancy));
+			memset(cache->faces, 0, sizeof(cache->faces));
+			memset(cache->sliceStart, 0, sizeof(cache->sliceStart));
+		}
+	}
+}
+
+// Meshes queued chunks and hands the results back to the main thread.
+// This runs in a dedicated thread.
+static int MesherThread(void* threadData)
+{
+	Mesher* mesher = threadData;
+	MeshScratch* scratch = malloc(sizeof(MeshScratch));
+
+	while (true)
+	{
+		SDL_LockMutex(mesher->mutex);
+
+		while (mesher->alive && mesher->jobs.size == 0)
+			SDL_CondWait(mesher->jobCond, mesher->mutex);
+
+		if (!mesher->alive)
+		{
+			SDL_UnlockMutex(mesher->mutex);
+			break;
+		}
+
+		MeshJob* job = (void*)ListUInt64Pop(&mesher->jobs);
+		SDL_UnlockMutex(mesher->mutex);
+
+		//Uint32 ticks = SDL_GetTicks();
+		MeshChunk(job, scratch, mesher->useAvx2);
+		//printf("Chunk mesh took %d ms for %d quads.\n", SDL_GetTicks() - ticks, job->quads.size);
+
+		SDL_LockMutex(mesher->mutex);
+		ListUInt64Insert(&mesher->results, (uint64_t)job);
+		SDL_UnlockMutex(mesher->mutex);
+	}
+
+	free(scratch);
+	return 0;
+}
+
+Mesher* Mesher_New(World* world)
+{
+	Mesher* mesher = calloc(1, sizeof(Mesher));
+	if (mesher == NULL) return NULL;
+
+	mesher->world = world;
+	mesher->mutex = SDL_CreateMutex();
+	mesher->jobCond = SDL_CreateCond();
+	mesher->alive = true;
+#ifdef MESHER_AVX2
+	mesher->useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+	ListUInt64Init(&mesher->jobs, 64);
+	ListUInt64Init(&mesher->results, 64);
+
+	for (int i = 0; i < NUM_MESH_THREADS; i++)
+		mesher->threads[i] = SDL_CreateThread(MesherThread, "Mesher Thread", mesher);
+
+	return mesher;
+}
+
+static void FreeJob(MeshJob* job)
+{
+	free(job->quads.values);
+	free(job->cache);
+	free(job);
+}
+
+static MeshCache* FindCache(Mesher* mesher, Chunk* chunk)
+{
+	for (int i = 0; i < MESH_CACHE_SIZE; i++)
+		if (mesher->caches[i] != NULL && mesher->caches[i]->chunk == chunk)
+			return mesher->caches[i];
+
+	return NULL;
+}
+
+// Frees a cache and lets its chunk's region be freed again.
+static void DropCache(Mesher* mesher, int index)
+{
+	mesher->caches[index]->chunk->meshRefs--;
+	free(mesher->caches[index]);
+	mesher->caches[index] = NULL;
+}
+
+// Keeps the cache that came back with a finished job, replacing the least recently used one if needed.
+static void InstallCache(Mesher* mesher, MeshJob* job)
+{
+	MeshCache* cache = job->cache;
+	int slot = 0;
+
+	for (int i = 0; i < MESH_CACHE_SIZE; i++)
+	{
+		if (mesher->caches[i] == NULL)
+		{
+			slot = i;
+			break;
+		}
+
+		if (mesher->caches[i]->lastUsed < mesher->caches[slot]->lastUsed)
+			slot = i;
+	}
+
+	if (mesher->caches[slot] != NULL) DropCache(mesher, slot);
+
+	cache->chunk = job->chunk;
+	cache->version = job->version;
+	cache->lastUsed = mesher->frame;
+	cache->chunk->meshRefs++;
+	mesher->caches[slot] = cache;
+	job->cache = NULL;
+}
+
+// Recomputes the faces of one row of blocks after the block at column changed.
+// Faces can change at that block and the ones on either side, and each changed face marks its slice dirty.
+static void PatchFaceRow(MeshCache* cache, Axis axis, int plane, int row, int column, bool* dirtySlices)
+{
+	uint64_t blocks = GetOccupancy(cache->occupancy, axis, plane, row);
+	bool prevBlock = (cache->boundary[(((2 * axis) + 1) * 64) + plane] >> row) & 1;
+	bool nextBlock = (cache->boundary[((2 * axis) * 64) + plane] >> row) & 1;
+	uint64_t faces[2] = { RightFaces(blocks, nextBlock), LeftFaces(blocks, prevBlock) };
+
+	for (int c = column - 1; c <= column + 1; c++)
+	{
+		if (c < 0 || c > 63) continue;
+
+		for (int i = 0; i < 2; i++)
+		{
+			int dir = (2 * axis) + i;
+			uint64_t* word = cache->faces + (dir * 4096) + (c * 64) + plane;
+			uint64_t patched = (*word & ~(1ull << row)) | (((faces[i] >> c) & 1) << row);
+
+			if (patched != *word)
+			{
+				*word = patched;
+				dirtySlices[(dir * 64) + c] = true;
+			}
+		}
+	}
+}
+
+// Applies the chunk's logged block edits to its cached masks, then re-meshes only the slices that changed.
+// The quads come out the same as meshing the whole chunk again.
+static void PatchCachedMesh(MeshCache* cache)
+{
+	Chunk* chunk = cache->chunk;
+	bool dirtySlices[NUM_SLICES] = { false };
+
+	for (int i = 0; i < chunk->numEdits; i++)
+	{
+		int x = chunk->edits[i] & 63;
+		int y = (chunk->edits[i] >> 6) & 63;
+		int z = chunk->edits[i] >> 12;
+		uint64_t solid = Blocks_Get(&chunk->blocks, GetMortonCode(x, y, z)) != 0;
+
+		uint64_t* xRow = cache->occupancy + (AXIS_X * 4096) + (z * 64) + y;
+		uint64_t* yRow = cache->occupancy + (AXIS_Y * 4096) + (z * 64) + x;
+		uint64_t* zRow = cache->occupancy + (AXIS_Z * 4096) + (y * 64) + x;
+		*xRow = (*xRow & ~(1ull << x)) | (solid << x);
+		*yRow = (*yRow & ~(1ull << y)) | (solid << y);
+		*zRow = (*zRow & ~(1ull << z)) | (solid << z);
+
+		PatchFaceRow(cache, AXIS_X, z, y, x, dirtySlices);
+		PatchFaceRow(cache, AXIS_Y, z, x, y, dirtySlices);
+		PatchFaceRow(cache, AXIS_Z, y, x, z, dirtySlices);
+	}
+
+	ListUInt64 quads;
+	ListUInt64Init(&quads, chunk->quads.size + 64);
+	uint32_t sliceStart[NUM_SLICES + 1];
+
+	for (int slice = 0; slice < NUM_SLICES; slice++)
+	{
+		sliceStart[slice] = quads.size;
+
+		if (dirtySlices[slice])
+		{
+			uint64_t planes[64];
+			memcpy(planes, cache->faces + (slice * 64), sizeof(planes));
+			GreedyMeshSlice(planes, slice / 64, slice % 64, &quads);
+		}
+		else
+		{
+			for (uint32_t q = cache->sliceStart[slice]; q < cache->sliceStart[slice + 1]; q++)
+				ListUInt64Insert(&quads, chunk->quads.values[q]);
+		}
+	}
+
+	sliceStart[NUM_SLICES] = quads.size;
+	memcpy(cache->sliceStart, sliceStart, sizeof(sliceStart));
+
+	SDL_LockMutex(chunk->mutex);
+	ListUInt64 oldQuads = chunk->quads;
+	chunk->quads = quads;
+	SDL_UnlockMutex(chunk->mutex);
+	free(oldQuads.values);
+}
+
+// Stops the mesher threads, waiting for any chunk in progress, and discards unfinished work.
+void Mesher_Destroy(Mesher* mesher)
+{
+	if (mesher == NULL) return;
+
+	SDL_LockMutex(mesher->mutex);
+	mesher->alive = false;
+	SDL_CondBroadcast(mesher->jobCond);
+	SDL_UnlockMutex(mesher->mutex);
+
+	for (int i = 0; i < NUM_MESH_THREADS; i++)
+		SDL_WaitThread(mesher->threads[i], NULL);
+
+	for (int i = 0; i < mesher->jobs.size; i++)
+		FreeJob((void*)mesher->jobs.values[i]);
+
+	for (int i = 0; i < mesher->results.size; i++)
+		FreeJob((void*)mesher->results.values[i]);
+
+	for (int i = 0; i < MESH_CACHE_SIZE; i++)
+		free(mesher->caches[i]);
+
+	free(mesher->jobs.values);
+	free(mesher->results.values);
+	SDL_DestroyCond(mesher->jobCond);
+	SDL_DestroyMutex(mesher->mutex);
+	free(mesher);
+}
+
+// Unpins the neighbors that QueueNeighbors found.
+static void ReleaseNeighbors(MeshJob* job)
+{
+	for (int side = 0; side < 6; side++)
+		for (int j = 0; j < NumNeighbors(job, side); j++)
+			job->neighbors[side][j]->meshRefs--;
+}
+
+// Swaps finished meshes into their chunks, up to a fixed number per frame.
+static void IntegrateResults(Mesher* mesher)
+{
+	MeshJob* finished[MESH_RESULTS_PER_FRAME];
+	int n = 0;
+
+	SDL_LockMutex(mesher->mutex);
+	while (n < MESH_RESULTS_PER_FRAME && mesher->results.size > 0)
+		finished[n++] = (void*)ListUInt64Pop(&mesher->results);
+	SDL_UnlockMutex(mesher->mutex);
+
+	for (int i = 0; i < n; i++)
+	{
+		MeshJob* job = finished[i];
+		Chunk* chunk = job->chunk;
+
+		if (!EnumHasFlag(chunk->flags, CHUNK_DEAD))
+		{
+			if (job->cache != NULL) InstallCache(mesher, job);
+
+			// The renderer holds the chunk mutex while it uses the quads, so the swap is atomic to it.
+			SDL_LockMutex(chunk->mutex);
+			ListUInt64 quads = chunk->quads;
+			chunk->quads = job->quads;
+			job->quads = quads;
+			SDL_UnlockMutex(chunk->mutex);
+
+			chunk->flags |= CHUNK_MESHED;
+			memcpy(chunk->neighborLods, job->neighborLods, sizeof(chunk->neighborLods));
+
+			// if the chunk was edited while it was being meshed, it stays dirty and will be meshed again
+			if (chunk->version == job->version)
+				EnumSetFlag((int*)(&chunk->flags), CHUNK_DIRTY, false);
+		}
+
+		EnumSetFlag((int*)(&chunk->flags), CHUNK_MESHING, false);
+		chunk->meshRefs--;
+		ReleaseNeighbors(job);
+		FreeJob(job);
+	}
+}
+
+// Finds and pins the neighbors of a chunk that is about to be meshed.
+// Neighbors that were meshed against something else on this side need to be meshed again.
+static void QueueNeighbors(World* world, MeshJob* job)
+{
+	Chunk* chunk = job->chunk;
+
+	for (int side = 0; side < 6; side++)
+	{
+		job->neighborLods[side] = FindNeighbors(world, chunk, side, job->neighbors[side]);
+		int opposite = side ^ 1;
+
+		for (int j = 0; j < NumNeighbors(job, side); j++)
+		{
+			Chunk* neighbor = job->neighbors[side][j];
+			neighbor->meshRefs++;
+
+			// A neighbor that is being meshed right now may not have seen this chunk either,
+			// and its neighborLods are still those of its last mesh, not the ones its job found.
+			bool meshing = EnumHasFlag(neighbor->flags, CHUNK_MESHING);
+			bool meshed = EnumHasFlag(neighbor->flags, CHUNK_MESHED);
+			if (meshing || (meshed && neighbor->neighborLods[opposite] != chunk->lodLevel))
+				World_MarkChunkDirty(world, neighbor);
+		}
+	}
+}
+
+// Gives a chunk of nothing but air its empty mesh right away, instead of queuing a job for it.
+// Its neighbors still need to know about it, in case they were meshed against something else.
+static void MeshEmptyChunk(World* world, Chunk* chunk)
+{
+	MeshJob job = { .chunk = chunk };
+	QueueNeighbors(world, &job);
+	ReleaseNeighbors(&job);
+
+	SDL_LockMutex(chunk->mutex);
+	chunk->quads.size = 0;
+	SDL_UnlockMutex(chunk->mutex);
+
+	chunk->flags |= CHUNK_MESHED;
+	memcpy(chunk->neighborLods, job.neighborLods, sizeof(chunk->neighborLods));
+	chunk->numEdits = 0;
+	EnumSetFlag((int*)(&chunk->flags), CHUNK_DIRTY, false);
+}
+
+// Queues dirty chunks for the mesher threads and swaps in finished meshes.
+// This runs on the main thread, so it never waits for a chunk to be meshed.
+void Mesher_MeshWorld(Mesher* mesher)
+{
+	World* world = mesher->world;
+	mesher->frame++;
+
+	IntegrateResults(mesher);
+
+	// let the regions of dead chunks be freed
+	for (int i = 0; i < MESH_CACHE_SIZE; i++)
+		if (mesher->caches[i] != NULL && EnumHasFlag(mesher->caches[i]->chunk->flags, CHUNK_DEAD))
+			DropCache(mesher, i);
+
+	SDL_LockMutex(world->mutex);
+	bool worldDirty = world->dirty;
+	world->dirty = false;
+	SDL_UnlockMutex(world->mutex);
+
+	if (!worldDirty) return;
+
 	bool dirty = false;
 	ListUInt64 chunkList = world->allChunks;
+	ListUInt64 newJobs;
+	ListUInt64Init(&newJobs, 64);
 
 	for (int i = 0; i < chunkList.size; i++)
 	{
 		Chunk *chunk = (void *)chunkList.values[i];
 		if (chunk == NULL) continue;
 
-		SDL_LockMutex(chunk->mutex);
-
 		if (!EnumHasFlag(chunk->flags, CHUNK_LOADED))
 		{
-			SDL_UnlockMutex(chunk->mutex);
 			dirty = true; // skip meshing this chunk and let the world remain dirty
 			continue;
 		}
 
-		if (!EnumHasFlag(chunk->flags, CHUNK_DIRTY))
+		if (!EnumHasFlag(chunk->flags, CHUNK_DIRTY)) continue;
+
+		// If every change since the cached masks is a logged block edit, the mesh is patched right away.
+		MeshCache* cache = FindCache(mesher, chunk);
+		if (cache != NULL && cache->version + chunk->numEdits == chunk->version)
 		{
-			SDL_UnlockMutex(chunk->mutex);
+			PatchCachedMesh(cache);
+			cache->version = chunk->version;
+			cache->lastUsed = mesher->frame;
+			chunk->numEdits = 0;
+			EnumSetFlag((int*)(&chunk->flags), CHUNK_DIRTY, false);
+			continue;
+		}
+
+		// Only the main thread changes loaded block data, so it can look at it without locking.
+		bool empty = Blocks_IsUniform(&chunk->blocks) && chunk->blocks.palette[0] == BLOCK_AIR;
+		if (empty && cache == NULL && !EnumHasFlag(chunk->flags, CHUNK_MESHING))
+		{
+			MeshEmptyChunk(world, chunk);
 			continue;
 		}
 
-		ticks = SDL_GetTicks();
-		chunk->occupancy = malloc(3 * sizeOfMaskArrays); // 96 kB
-		memset(chunk->occupancy, 0, 3 * sizeOfMaskArrays);
-		chunk->faceMasks = malloc(6 * sizeOfMaskArrays); // 192 kB
-		memset(chunk->faceMasks, 0, 6 * sizeOfMaskArrays);
+		// check back later for chunks that are already being meshed
+		dirty = true;
+		if (EnumHasFlag(chunk->flags, CHUNK_MESHING)) continue;
 
-		if (GenerateOccupancyMasks(chunk))
+		// sort key: squared distance from the visible center above the list index
+		uint64_t d = 0;
+		for (int a = 0; a < 3; a++)
 		{
-			GenerateFaceMasks(chunk, world);
-			GreedyMesh(chunk);
+			int64_t delta = chunk->coords[a] - world->visibleCenter[a];
+			d += delta * delta;
 		}
 
-		free(chunk->occupancy);
-		free(chunk->faceMasks);
-		EnumSetFlag((int*)(&chunk->flags), CHUNK_DIRTY, false);
-		SDL_UnlockMutex(chunk->mutex);
+		if (d > 0xffffffff) d = 0xffffffff;
+		ListUInt64Insert(&newJobs, (d << 32) | i);
+	}
+
+	// Farthest chunks go in first, because the mesher threads take jobs from the end of the list.
+	qsort(newJobs.values, newJobs.size, sizeof(uint64_t), CompareUInt64);
+
+	SDL_LockMutex(mesher->mutex);
+
+	for (int i = (int)newJobs.size - 1; i >= 0; i--)
+	{
+		Chunk* chunk = (void*)chunkList.values[newJobs.values[i] & 0xffffffff];
+		MeshJob* job = malloc(sizeof(MeshJob));
+		job->chunk = chunk;
+		job->version = chunk->version;
+		job->cache = NULL;
+		ListUInt64Init(&job->quads, 64);
+
+		// Edited chunks get a cache, so that further edits can be patched in without another job.
+		bool wantCache = chunk->numEdits > 0;
+		for (int c = 0; c < MESH_CACHE_SIZE; c++)
+		{
+			if (mesher->caches[c] != NULL && mesher->caches[c]->chunk == chunk)
+			{
+				DropCache(mesher, c);
+				wantCache = true;
+			}
+		}
 
-		ticks = SDL_GetTicks() - ticks;
-		//printf("Chunk mesh took %d ms for %d quads.\n", ticks, chunk->quads.size);
+		if (wantCache) job->cache = malloc(sizeof(MeshCache));
+		chunk->numEdits = 0;
+		chunk->flags |= CHUNK_MESHING;
+		chunk->meshRefs++;
+		QueueNeighbors(world, job);
+		ListUInt64Insert(&mesher->jobs, (uint64_t)job);
 	}
 
-	if (!dirty) world->dirty = false;
-	SDL_UnlockMutex(world->mutex);
+	if (newJobs.size > 0) SDL_CondBroadcast(mesher->jobCond);
+	SDL_UnlockMutex(mesher->mutex);
+	free(newJobs.values);
+
+	if (dirty)
+	{
+		SDL_LockMutex(world->mutex);
+		world->dirty = true;
+		SDL_UnlockMutex(world->mutex);
+	}
+}
+
+typedef struct
+{
+	MeshScratch* scratch;
+	bool useAvx2;
+	CodecContext codec;
+	BlockStorage blocks;
+	ListUInt64 quads;
+	ListUInt64 expected; // quads of the per-face mesher
+	int numChunks;
+	int numErrors;
+	uint64_t numQuads;
+	uint64_t faceTicks; // occupancy and face masks
+	uint64_t scalarTicks;
+	uint64_t fastTicks;
+} MeshBenchmark;
+
+// Meshes the blocks in the scratch memory as if the chunk had no neighbors, with both greedy meshers,
+// which must give the same quads.
+static void BenchmarkMeshChunk(MeshBenchmark* bench)
+{
+	MeshScratch* scratch = bench->scratch;
+	memset(scratch->boundary, 0, sizeof(scratch->boundary));
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	if (!GenerateOccupancyMasks(scratch->blocks, scratch->occupancy, bench->useAvx2)) return;
+	GenerateFaceMasks(scratch);
+	Uint64 faces = SDL_GetPerformanceCounter();
+	GreedyMesh(scratch, &bench->quads, NULL);
+	Uint64 middle = SDL_GetPerformanceCounter();
+	GreedyMeshScalar(scratch->faceMasks, &bench->expected);
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	bench->faceTicks += faces - start;
+	bench->fastTicks += middle - faces;
+	bench->scalarTicks += end - middle;
+	bench->numQuads += bench->expected.size;
+	bench->numChunks++;
+
+	bool same = bench->quads.size == bench->expected.size
+		&& memcmp(bench->quads.values, bench->expected.values, bench->quads.size * sizeof(uint64_t)) == 0;
+	if (!same) bench->numErrors++;
+}
+
+// Fills chunks with rolling hills, with random blocks at a few densities, and with a 3D checkerboard,
+// which has the most faces a chunk can have.
+static void BenchmarkMeshSynthetic(MeshBenchmark* bench)
+{
+	static const int densities[] = { 5, 50, 95 }; // percent of solid blocks
+	uint8_t* blocks = bench->scratch->blocks;
+	srand(1);
+
+	for (int variant = 0; variant < 4; variant++)
+	{
+		for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+		{
+			int x, y, z;
+			SplitMortonCode(i, &x, &y, &z);
+			float height = 32 + (12 * sinf((x + (variant * 16)) / 7.0f) * cosf(z / 9.0f));
+			blocks[i] = y < height - 3 ? BLOCK_STONE : (y < height ? BLOCK_DIRT : BLOCK_AIR);
+		}
+
+		BenchmarkMeshChunk(bench);
+	}
+
+	for (int d = 0; d < 3; d++)
+	{
+		for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+			blocks[i] = (rand() % 100) < densities[d] ? BLOCK_STONE : BLOCK_AIR;
+
+		BenchmarkMeshChunk(bench);
+	}
+
+	for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+	{
+		int x, y, z;
+		SplitMortonCode(i, &x, &y, &z);
+		blocks[i] = ((x + y + z) % 2) ? BLOCK_STONE : BLOCK_AIR;
+	}
+
+	BenchmarkMeshChunk(bench);
+}
+
+static void BenchmarkMeshRegionFile(const RegionFile* rf, const ArchivedRegion* region, void* data)
+{
+	MeshBenchmark* bench = data;
+
+	for (int i = 0; i < rf->numChunks; i++)
+	{
+		if (!RegionFile_ReadChunk(rf, i, &bench->blocks, &bench->codec)) break;
+		if (Blocks_IsUniform(&bench->blocks)) continue;
+
+		Blocks_Unpack(&bench->blocks, bench->scratch->blocks);
+		BenchmarkMeshChunk(bench);
+	}
+}
+
+static void PrintMeshBenchmark(MeshBenchmark* bench, const char* name)
+{
+	double frequency = (double)SDL_GetPerformanceFrequency();
+
+	printf("%s: %d chunks, %.0f quads per chunk, %d errors\n", name, bench->numChunks,
+		(double)bench->numQuads / bench->numChunks, bench->numErrors);
+	printf("  %-14s %10.1f us/chunk\n", "face masks", bench->faceTicks / frequency * 1e6 / bench->numChunks);
+	printf("  %-14s %10.1f us/chunk\n", "greedy by face", bench->scalarTicks / frequency * 1e6 / bench->numChunks);
+	printf("  %-14s %10.1f us/chunk\n", "greedy by row", bench->fastTicks / frequency * 1e6 / bench->numChunks);
+
+	bench->numChunks = 0;
+	bench->numErrors = 0;
+	bench->numQuads = 0;
+	bench->faceTicks = 0;
+	bench->scalarTicks = 0;
+	bench->fastTicks = 0;
+}
+
+// Checks that the greedy mesher gives the same quads as the original one that looks at one face at a time,
+// and compares their speed, on generated chunks and on the saved non-uniform chunks of a world folder.
+// Chunks are meshed without neighbors. Building the face masks is timed separately, since both meshers need them.
+void Mesher_Benchmark(char* folderPath)
+{
+	MeshBenchmark bench = { 0 };
+	bench.scratch = malloc(sizeof(MeshScratch));
+	CodecContext_Init(&bench.codec);
+	ListUInt64Init(&bench.quads, 4096);
+	ListUInt64Init(&bench.expected, 4096);
+#ifdef MESHER_AVX2
+	bench.useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	BenchmarkMeshSynthetic(&bench);
+	PrintMeshBenchmark(&bench, "generated chunks");
+
+	ArchiveSet* set = Archive_OpenSet(folderPath);
+	Region_VisitArchives(set, BenchmarkMeshRegionFile, &bench);
+	Archive_CloseSet(set);
+	if (bench.numChunks > 0) PrintMeshBenchmark(&bench, folderPath);
+
+	Blocks_Free(&bench.blocks);
+	CodecContext_Free(&bench.codec);
+	free(bench.quads.values);
+	free(bench.expected.values);
+	free(bench.scratch);
 }
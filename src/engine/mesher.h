@@ -3,4 +3,10 @@
 #include "world.h"
 #include "utility.h"
 
-void Mesher_MeshWorld(World* world);
+struct Mesher;
+typedef struct Mesher Mesher;
+
+Mesher* Mesher_New(World* world);
+void Mesher_Destroy(Mesher* mesher);
+void Mesher_MeshWorld(Mesher* mesher);
+void Mesher_Benchmark(char* folderPath);
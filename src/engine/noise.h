@@ -7,7 +7,12 @@ typedef struct
 	bool initialized;
 	uint64_t seed;
 	uint8_t influences[256 * 2];
+	// the gradient of the influence at each index, for the float 2D noise
+	float gradientX[256 * 2];
+	float gradientY[256 * 2];
 } NoiseMaker;
 
 uint8_t* Noise_Generate2D(NoiseMaker* nm, int ofsX, int ofsY, float* progress);
+uint8_t* Noise_Generate2DLod(NoiseMaker* nm, int ofsX, int ofsY, int lodLevel, float* progress);
 uint8_t* Noise_Generate3D(NoiseMaker* nm, int ofsX, int ofsY, int ofsZ, float* progress);
+void Noise_Benchmark(void);
@@ -0,0 +1,308 @@
+// Reads several whole files in one go. With io_uring the reads of a batch are all submitted before waiting for any
+// of them, so the disk can work on them in parallel, instead of one small read per file and thread at a time.
+// The ring is set up with raw system calls, so it doesn't need liburing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "readbatch.h"
+
+#ifdef __linux__
+#define READ_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+enum
+{
+	URING_ENTRIES = 32, // reads in flight at once
+	URING_MAX_READ = 1 << 30, // bytes per read request
+};
+
+// Reads one file or part with stdio. Returns false if it is missing, empty, or unreadable.
+static bool ReadFile(FileRead *read)
+{
+	FILE *file = fopen(read->path, "rb");
+	if (file == NULL) return false;
+
+	long size = read->size;
+	if (size == 0 && fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+
+	if (size > 0 && fseek(file, read->offset, SEEK_SET) == 0)
+	{
+		read->data = malloc(size);
+		read->size = size;
+
+		if (fread(read->data, 1, size, file) != (size_t)size)
+		{
+			free(read->data);
+			read->data = NULL;
+		}
+	}
+
+	fclose(file);
+	return read->data != NULL;
+}
+
+#ifdef READ_URING
+
+typedef struct
+{
+	int fd;
+	unsigned entries;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *rings[2];
+	size_t ringSizes[2];
+	size_t sqesSize;
+} Uring;
+
+static void Uring_Destroy(Uring *ring)
+{
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+	if (ring->rings[1] != NULL && ring->rings[1] != MAP_FAILED && ring->rings[1] != ring->rings[0]) munmap(ring->rings[1], ring->ringSizes[1]);
+	if (ring->rings[0] != NULL && ring->rings[0] != MAP_FAILED) munmap(ring->rings[0], ring->ringSizes[0]);
+	if (ring->fd >= 0) close(ring->fd);
+	memset(ring, 0, sizeof(Uring));
+	ring->fd = -1;
+}
+
+static bool Uring_Init(Uring *ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(Uring));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) return false;
+
+	// Newer kernels map both rings at once.
+	ring->entries = params.sq_entries;
+	ring->ringSizes[0] = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+	ring->ringSizes[1] = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+	bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+	if (singleMap && ring->ringSizes[1] > ring->ringSizes[0]) ring->ringSizes[0] = ring->ringSizes[1];
+
+	ring->rings[0] = mmap(NULL, ring->ringSizes[0], PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->rings[0] == MAP_FAILED) goto fail;
+
+	ring->rings[1] = singleMap ? ring->rings[0]
+		: mmap(NULL, ring->ringSizes[1], PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->rings[1] == MAP_FAILED) goto fail;
+
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) goto fail;
+
+	uint8_t *sq = ring->rings[0];
+	uint8_t *cq = ring->rings[1];
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return true;
+
+	fail:
+	Uring_Destroy(ring);
+	return false;
+}
+
+typedef struct
+{
+	int fd;
+	size_t done; // bytes read so far
+} UringFile;
+
+// Queues a read of everything that is left of a file. The kernel only sees it once the tail is published.
+static void Uring_QueueRead(Uring *ring, unsigned *tail, FileRead *read, UringFile *file, int index)
+{
+	unsigned slot = *tail & *ring->sqMask;
+	size_t left = read->size - file->done;
+
+	struct io_uring_sqe *sqe = ring->sqes + slot;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = file->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(read->data + file->done);
+	sqe->len = left < URING_MAX_READ ? left : URING_MAX_READ;
+	sqe->off = read->offset + file->done;
+	sqe->user_data = index;
+
+	ring->sqArray[slot] = slot;
+	(*tail)++;
+}
+
+// Reads the files through io_uring. Returns false if the ring is unavailable or failed,
+// in which case the reads that didn't finish are left for the stdio path.
+static bool UringRead(FileRead *reads, int numReads, bool *finished)
+{
+	Uring ring;
+	if (!Uring_Init(&ring, URING_ENTRIES)) return false;
+
+	UringFile files[numReads];
+	int pending[numReads]; // reads waiting to be submitted, as a stack
+	int numPending = 0;
+	int numInFlight = 0;
+	unsigned numUnsubmitted = 0; // queued in the ring, but not taken by the kernel yet
+	bool success = true;
+
+	for (int i = 0; i < numReads; i++)
+	{
+		files[i].fd = -1;
+		files[i].done = 0;
+		if (reads[i].path == NULL) continue;
+
+		struct stat stats;
+		int fd = open(reads[i].path, O_RDONLY);
+
+		if (fd >= 0 && reads[i].size == 0 && fstat(fd, &stats) == 0) reads[i].size = stats.st_size;
+
+		if (fd < 0 || reads[i].size == 0)
+		{
+			// missing files are expected, since regions that were never generated have none
+			if (fd >= 0) close(fd);
+			finished[i] = true;
+			continue;
+		}
+
+		files[i].fd = fd;
+		reads[i].data = malloc(reads[i].size);
+		pending[numPending++] = i;
+	}
+
+	while (numPending > 0 || numInFlight > 0)
+	{
+		unsigned tail = *ring.sqTail;
+
+		for (; numPending > 0 && numInFlight < (int)ring.entries; numInFlight++, numUnsubmitted++)
+		{
+			int i = pending[--numPending];
+			Uring_QueueRead(&ring, &tail, reads + i, files + i, i);
+		}
+
+		__atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+		// submits the new reads and waits for at least one to complete
+		long numTaken = syscall(__NR_io_uring_enter, ring.fd, numUnsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (numTaken >= 0)
+		{
+			numUnsubmitted -= numTaken;
+		}
+		else if (errno != EINTR)
+		{
+			success = false;
+			break;
+		}
+
+		unsigned head = *ring.cqHead;
+		unsigned cqTail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+		for (; head != cqTail; head++)
+		{
+			struct io_uring_cqe *cqe = ring.cqes + (head & *ring.cqMask);
+			int i = cqe->user_data;
+			numInFlight--;
+
+			if (cqe->res == -EAGAIN || cqe->res == -EINTR)
+			{
+				pending[numPending++] = i;
+			}
+			else if (cqe->res <= 0)
+			{
+				// an error, or the file got shorter than it was
+				free(reads[i].data);
+				reads[i].data = NULL;
+				finished[i] = true;
+			}
+			else
+			{
+				files[i].done += cqe->res;
+				if (files[i].done < reads[i].size) pending[numPending++] = i;
+				else finished[i] = true;
+			}
+		}
+
+		__atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	// Closing the ring waits for reads that are still in flight, so only then can their buffers be freed.
+	Uring_Destroy(&ring);
+
+	for (int i = 0; i < numReads; i++)
+	{
+		if (files[i].fd >= 0) close(files[i].fd);
+
+		if (!finished[i] && reads[i].data != NULL)
+		{
+			free(reads[i].data);
+			reads[i].data = NULL;
+		}
+	}
+
+	return success;
+}
+
+// Checks once whether the kernel allows io_uring, which can be missing or disabled.
+bool ReadBatch_UringSupported(void)
+{
+	Uring ring;
+	if (!Uring_Init(&ring, 1)) return false;
+
+	Uring_Destroy(&ring);
+	return true;
+}
+
+#else
+
+bool ReadBatch_UringSupported(void)
+{
+	return false;
+}
+
+#endif
+
+// Reads every file or part in the list into memory, and sets data to NULL for those that can't be read.
+// If io_uring fails, the reads fall back to stdio.
+void ReadBatch_Read(FileRead *reads, int numReads, ReadBackend backend)
+{
+	bool finished[numReads];
+
+	for (int i = 0; i < numReads; i++)
+	{
+		reads[i].data = NULL;
+		finished[i] = reads[i].path == NULL;
+	}
+
+#ifdef READ_URING
+	if (backend == READ_BACKEND_URING && UringRead(reads, numReads, finished)) return;
+#endif
+
+	for (int i = 0; i < numReads; i++)
+		if (!finished[i]) ReadFile(reads + i);
+}
+
+void ReadBatch_Free(FileRead *reads, int numReads)
+{
+	for (int i = 0; i < numReads; i++)
+	{
+		free(reads[i].data);
+		reads[i].data = NULL;
+	}
+}
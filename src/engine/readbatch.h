@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+	READ_BACKEND_STDIO, // one file after the other with fread
+	READ_BACKEND_URING, // all files at once through io_uring, Linux only
+} ReadBackend;
+
+// One file, or one part of a file, to read. data is allocated by the read, and stays NULL if the file is missing,
+// empty, shorter than the part, or unreadable.
+typedef struct
+{
+	char *path; // NULL to skip this entry
+	uint64_t offset; // where the part starts
+	size_t size; // bytes in the part, or 0 to read the whole file, which sets it to the file size
+	uint8_t *data;
+} FileRead;
+
+bool ReadBatch_UringSupported(void);
+void ReadBatch_Read(FileRead *reads, int numReads, ReadBackend backend);
+void ReadBatch_Free(FileRead *reads, int numReads);
@@ -17,6 +17,13 @@
 #include "utility.h"
 #include "mesher.h"
 
+// Start of a chunk's block buffer, matching the one in cFrag.glsl. The packed palette indices follow it.
+typedef struct
+{
+	GLuint bits; // width of each index, 0 for a chunk of one type
+	GLubyte palette[256];
+} ChunkBlocksHeader;
+
 static void LoadTextureArray(GLuint texture, const char* filePath, int nCols, int nRows)
 {
 	// https://stackoverflow.com/questions/59260533/using-texture-atlas-as-texture-array-in-opengl
@@ -272,14 +279,9 @@ void Render_InitBuffers(RenderState* rs)
 	printf("Initialized shape buffers.\n");
 
 	glGenVertexArrays(1, &rs->chunkBAO);
-	glGenBuffers(1, &rs->chunkBBO);
 	glGenBuffers(1, &rs->chunkQBO);
 	glBindVertexArray(rs->chunkBAO);
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rs->chunkBBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, rs->chunkBBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 	glBindBuffer(GL_ARRAY_BUFFER, rs->chunkQBO);
 	glEnableVertexAttribArray(0);
 	glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 2 * sizeof(GLuint), (GLvoid*)0);
@@ -301,7 +303,6 @@ void Render_Destroy(RenderState* rs)
 	glDeleteBuffers(rs->numShapes, rs->IBO);
 	glDeleteBuffers(rs->numShapes, rs->EBO);
 	glDeleteVertexArrays(1, &rs->chunkBAO);
-	glDeleteBuffers(1, &rs->chunkBBO);
 	glDeleteBuffers(1, &rs->chunkQBO);
 	glDeleteTextures(rs->numTextures, rs->textures);
 	glDeleteProgram(rs->basicShader);
@@ -315,8 +316,8 @@ void Render_Destroy(RenderState* rs)
 }
 
 // Sets the GL viewport while maintaining aspect ratio.
-// Calculates the projection and view matrices.
-static void SetViewport(RenderState *rs)
+// Calculates the projection and view matrices. farPlane should cover the loaded chunks.
+static void SetViewport(RenderState *rs, float farPlane)
 {
 	const float ratio = 0.5625f; // 1080/1920
 	int wWidth, wHeight, offsetX, offsetY;
@@ -340,7 +341,7 @@ static void SetViewport(RenderState *rs)
 	glViewport(offsetX, offsetY, wWidth, wHeight);
 
 	glm_mat4_identity(rs->matProj);
-	glm_perspective(45.0f, (GLfloat)wWidth / (GLfloat)wHeight, 0.1f, 2000.0f, rs->matProj);
+	glm_perspective(45.0f, (GLfloat)wWidth / (GLfloat)wHeight, 0.1f, farPlane, rs->matProj);
 
 	glm_mat4_identity(rs->matView);
 	Camera_GetViewMatrix(&rs->camera, rs->matView);
@@ -353,7 +354,7 @@ void Render_Draw(GameState *gs)
 	glClearColor(0.4f, 0.6f, 0.8f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glLoadIdentity();
-	SetViewport(rs);
+	SetViewport(rs, (float)World_GetViewDistance(gs->world));
 
 	glUseProgram(rs->basicShader);
 	GLint projLoc = glGetUniformLocation(rs->basicShader, "ourProj");
@@ -422,22 +423,38 @@ void Render_Draw(GameState *gs)
 	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, (void*)(rs->matView));
 	glBindTexture(GL_TEXTURE_2D, rs->textures[8]);
 	glBindVertexArray(rs->chunkBAO);
-	const size_t numBlocks = 64 * 64 * 64;
 	ListUInt64 chunkList = gs->world->allChunks;
 
 	SDL_LockMutex(gs->world->mutex);
 
+	// blocks of chunks that aren't drawn anymore
+	for (int i = 0; i < gs->world->freedBuffers.size; i++)
+	{
+		GLuint buffer = (GLuint)gs->world->freedBuffers.values[i];
+		glDeleteBuffers(1, &buffer);
+	}
+
+	gs->world->freedBuffers.size = 0;
+
 	for (int i = 0; i < chunkList.size; i++)
 	{
 		Chunk* chunk = (void *)chunkList.values[i];
 		if (chunk == NULL) continue;
 		if (!EnumHasFlag(chunk->flags, CHUNK_LOADED)) continue;
-		if (EnumHasFlag(chunk->flags, CHUNK_DIRTY)) continue;
+		if (!EnumHasFlag(chunk->flags, CHUNK_MESHED)) continue;
 		if (EnumHasFlag(chunk->flags, CHUNK_DEAD)) continue;
 
 		SDL_LockMutex(chunk->mutex);
 
 		ListUInt64 quads = chunk->quads;
+
+		// nothing to draw, such as a chunk of air or solid chunk with no exposed sides
+		if (quads.size == 0)
+		{
+			SDL_UnlockMutex(chunk->mutex);
+			continue;
+		}
+
 		vec3 chunkPos;
 		chunkPos[0] = chunk->coords[0] * 64;
 		chunkPos[1] = chunk->coords[1] * 64;
@@ -452,15 +469,27 @@ void Render_Draw(GameState *gs)
 
 		glUniformMatrix4fv(glGetUniformLocation(rs->chunkShader, "ourModel"), 1, GL_FALSE, (void*)chunkModel);
 
-		// TODO: Keep all chunks in one buffer and call glBufferSubData.
-		// TODO: Only buffer if chunk has changed.
-		if (true)
+		// Each chunk keeps its blocks in its own buffer, which is only filled again after the blocks change.
+		// The shader looks up the packed palette indices as they are stored, so nothing is unpacked.
+		if (chunk->drawBuffer == 0 || chunk->drawVersion != chunk->version)
 		{
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, rs->chunkBBO);
-			glBufferData(GL_SHADER_STORAGE_BUFFER, numBlocks * sizeof(GLubyte), chunk->blocks, GL_DYNAMIC_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, rs->chunkQBO);
-			glBufferData(GL_ARRAY_BUFFER, quads.size * sizeof(GLuint64), quads.values, GL_DYNAMIC_DRAW);
+			if (chunk->drawBuffer == 0) glGenBuffers(1, &chunk->drawBuffer);
+
+			ChunkBlocksHeader header = { .bits = chunk->blocks.bits };
+			memcpy(header.palette, chunk->blocks.palette, chunk->blocks.paletteSize);
+			size_t dataSize = Blocks_MemorySize(&chunk->blocks);
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunk->drawBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(header) + dataSize, NULL, GL_DYNAMIC_DRAW);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+			if (dataSize > 0) glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(header), dataSize, chunk->blocks.data);
+			chunk->drawVersion = chunk->version;
 		}
+
+		// TODO: Keep all chunks in one buffer and call glBufferSubData.
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, chunk->drawBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, rs->chunkQBO);
+		glBufferData(GL_ARRAY_BUFFER, quads.size * sizeof(GLuint64), quads.values, GL_DYNAMIC_DRAW);
 		SDL_UnlockMutex(chunk->mutex);
 
 		glDrawArrays(GL_POINTS, 0, quads.size);
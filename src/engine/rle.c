@@ -0,0 +1,567 @@
+// Run-length encoding (RLE) of the block types of a chunk in z-order.
+//
+// Each run is its length followed by its block type. Lengths up to 254 take one byte. Longer ones start with 0 and
+// take two more bytes, or with 0xff and take four more.
+//
+// Runs are found in the packed palette indices instead of looking up every block, 16 bytes of indices at a time,
+// and decoding writes the indices of each run straight into packed storage.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL2/SDL.h"
+#include "rle.h"
+#include "compress.h"
+#include "utility.h"
+
+#ifdef __SSE2__
+#define RLE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Writes the length and block type of a run. Returns the number of bytes written.
+static inline int PutRun(uint8_t *rle, uint32_t runLength, uint8_t type)
+{
+	int b = 0;
+
+	if (runLength > 0xffff)
+	{
+		rle[b++] = 0xff; // four-byte length indicator
+		rle[b++] = (uint8_t)runLength;
+		rle[b++] = (uint8_t)(runLength >> 8);
+		rle[b++] = (uint8_t)(runLength >> 16);
+		rle[b++] = (uint8_t)(runLength >> 24);
+	}
+	else if (runLength > 0xfe)
+	{
+		rle[b++] = 0; // two-byte length indicator
+		rle[b++] = (uint8_t)runLength;
+		rle[b++] = (uint8_t)(runLength >> 8);
+	}
+	else
+	{
+		rle[b++] = (uint8_t)runLength;
+	}
+
+	rle[b++] = type;
+	return b;
+}
+
+// Reads the length and block type of a run at b, and returns the position after it, or -1 if the run doesn't fit.
+static inline int GetRun(const uint8_t *rle, int numBytes, int b, uint32_t *runLength, uint8_t *type)
+{
+	if (b >= numBytes) return -1;
+	uint8_t firstByte = rle[b++];
+	int lengthBytes = firstByte == 0xff ? 4 : (firstByte == 0 ? 2 : 0);
+	if (b + lengthBytes >= numBytes) return -1;
+
+	*runLength = firstByte;
+
+	if (lengthBytes > 0)
+	{
+		*runLength = 0;
+
+		for (int k = 0; k < lengthBytes; k++)
+			*runLength |= (uint32_t)rle[b++] << (k * 8);
+	}
+
+	*type = rle[b++];
+	return b;
+}
+
+// Returns the first block at or after start whose palette index isn't the one repeated in pattern,
+// or BLOCKS_PER_CHUNK if there is none.
+static int FindRunEnd(const uint64_t *data, int bits, int start, uint64_t pattern)
+{
+	const int numWords = (BLOCKS_PER_CHUNK * bits) / 64;
+	int bit = start * bits;
+	int w = bit >> 6;
+
+	// the rest of the first word, with the blocks before start shifted out
+	uint64_t diff = (data[w] ^ pattern) >> (bit & 63);
+	if (diff != 0) return start + (CountTrailingZeros64(diff) / bits);
+
+	w++;
+
+#ifdef RLE_SSE2
+	// Long runs are skipped 16 bytes at a time. Every index width divides 8, so each byte of the pattern is the same,
+	// and a byte that differs has a different index in it.
+	__m128i wide = _mm_set1_epi64x(pattern);
+
+	for (; w + 2 <= numWords; w += 2)
+	{
+		__m128i words = _mm_loadu_si128((const __m128i *)(data + w));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(words, wide)) != 0xffff) break;
+	}
+#endif
+
+	for (; w < numWords; w++)
+	{
+		diff = data[w] ^ pattern;
+		if (diff != 0) return ((w * 64) + CountTrailingZeros64(diff)) / bits;
+	}
+
+	return BLOCKS_PER_CHUNK;
+}
+
+// Compresses a chunk with run-length encoding (RLE). The output is the same as Rle_EncodeChunkScalar's.
+// rle must hold 2 * BLOCKS_PER_CHUNK bytes, which is the worst case.
+RleInfo Rle_EncodeChunk(const BlockStorage *blocks, uint8_t *rle)
+{
+	RleInfo info = { .numBytes = 0, .numRuns = 0 };
+	int bits = blocks->bits;
+
+	if (bits == 0)
+	{
+		info.numBytes = PutRun(rle, BLOCKS_PER_CHUNK, blocks->palette[0]);
+		info.numRuns = 1;
+		return info;
+	}
+
+	// repeats an index across a whole word, like 0x1111111111111111 does for 4 bits
+	const uint64_t repeat = ~0ull / ((1ull << bits) - 1);
+	const uint64_t mask = (1ull << bits) - 1;
+
+	for (int i = 0; i < BLOCKS_PER_CHUNK; info.numRuns++)
+	{
+		int bit = i * bits;
+		uint64_t index = (blocks->data[bit >> 6] >> (bit & 63)) & mask;
+		int end = FindRunEnd(blocks->data, bits, i, index * repeat);
+
+		info.numBytes += PutRun(rle + info.numBytes, end - i, blocks->palette[index]);
+		i = end;
+	}
+
+	return info;
+}
+
+// Sets the indices of blocks start to end - 1 to the one repeated in pattern. Blocks must be filled in order,
+// since the bits after end are overwritten too.
+static inline void FillIndices(uint64_t *data, int bits, int start, int end, uint64_t pattern)
+{
+	int bit = start * bits;
+	int w = bit >> 6;
+	int last = ((end * bits) - 1) >> 6;
+
+	if ((bit & 63) != 0)
+	{
+		uint64_t low = (1ull << (bit & 63)) - 1;
+		data[w] = (data[w] & low) | (pattern & ~low);
+		w++;
+	}
+
+	for (; w <= last; w++)
+		data[w] = pattern;
+}
+
+// Fills in a chunk from RLE. The result is the same as Rle_DecodeChunk followed by Blocks_Pack, including for
+// broken data, but the runs go straight into the packed indices.
+void Rle_DecodeBlocks(BlockStorage *blocks, const uint8_t *rle, RleInfo info)
+{
+	const int fullSize = BLOCKS_PER_CHUNK;
+	int16_t lookup[256];
+	memset(lookup, -1, sizeof(lookup));
+	uint8_t palette[256];
+	int paletteSize = 0;
+	int numRuns = 0;
+	int n = 0; // number of blocks covered by the runs
+	int b = 0; // byte index of rle
+
+	// The first pass checks the runs and finds the palette, in the order the types first appear, like Blocks_Pack.
+	for (; numRuns < info.numRuns; numRuns++)
+	{
+		uint32_t runLength;
+		uint8_t type;
+		int next = GetRun(rle, info.numBytes, b, &runLength, &type);
+		if (next < 0) break;
+		b = next;
+
+		if (n >= fullSize)
+		{
+			printf("Error: Too many runs in the chunk.\n");
+			break;
+		}
+
+		if (runLength > (uint32_t)(fullSize - n))
+		{
+			printf("Error: A run is too long for the chunk.\n");
+			runLength = fullSize - n;
+		}
+
+		if (runLength > 0 && lookup[type] < 0)
+		{
+			lookup[type] = paletteSize;
+			palette[paletteSize++] = type;
+		}
+
+		n += runLength;
+	}
+
+	if (b != info.numBytes)
+		printf("Error: Corrupt RLE data.\n");
+
+	if (n < fullSize)
+	{
+		// the rest is air
+		printf("Error: Incomplete chunk.\n");
+
+		if (lookup[BLOCK_AIR] < 0)
+		{
+			lookup[BLOCK_AIR] = paletteSize;
+			palette[paletteSize++] = BLOCK_AIR;
+		}
+	}
+
+	if (paletteSize == 1)
+	{
+		Blocks_Fill(blocks, palette[0]);
+		return;
+	}
+
+	int bits = Blocks_BitsForPaletteSize(paletteSize);
+	const uint64_t repeat = ~0ull / ((1ull << bits) - 1);
+	uint64_t *data = malloc(((size_t)fullSize * bits) / 8);
+	n = 0;
+	b = 0;
+
+	// the runs were all checked above
+	for (int i = 0; i < numRuns; i++)
+	{
+		uint32_t runLength = 0;
+		uint8_t type = 0;
+		b = GetRun(rle, info.numBytes, b, &runLength, &type);
+		if (runLength > (uint32_t)(fullSize - n)) runLength = fullSize - n;
+		if (runLength == 0) continue;
+
+		FillIndices(data, bits, n, n + runLength, lookup[type] * repeat);
+		n += runLength;
+	}
+
+	if (n < fullSize) FillIndices(data, bits, n, fullSize, lookup[BLOCK_AIR] * repeat);
+
+	Blocks_Fill(blocks, palette[0]);
+	memcpy(blocks->palette, palette, paletteSize);
+	blocks->paletteSize = paletteSize;
+	blocks->bits = bits;
+	blocks->data = data;
+}
+
+// Compresses a chunk one block at a time. Caller is responsible for managing the output buffer.
+RleInfo Rle_EncodeChunkScalar(const BlockStorage *blocks, uint8_t *rle)
+{
+	const int sideSize = 64;
+	const int fullSize = sideSize * sideSize * sideSize;
+	RleInfo info = { .numBytes = 0, .numRuns = 0 };
+	int b = 0; // byte index for output
+	int runLength = 1;
+	uint8_t runBlock = Blocks_Get(blocks, 0);
+	uint8_t curBlock = runBlock;
+
+	// Start at 1 because the first one has been read.
+	// One extra iteration for the special case at the end.
+	for (int i = 1; i <= fullSize; i++)
+	{
+		if (i == fullSize) goto end_run; // end the last run
+
+		curBlock = Blocks_Get(blocks, i);
+
+		if (curBlock == runBlock)
+		{
+			runLength++;
+			continue;
+		}
+
+		end_run:
+		int numBytes;
+
+		// encode the run length, which uses a variable number of bytes
+		if (runLength > 0xffff)
+		{
+			numBytes = 6;
+			rle[b++] = 0xff; // four-byte length indicator
+			rle[b++] = (uint8_t)runLength;
+			rle[b++] = (uint8_t)(runLength >> 8);
+			rle[b++] = (uint8_t)(runLength >> 16);
+			rle[b++] = (uint8_t)(runLength >> 24);
+		}
+		else if (runLength > 0xfe)
+		{
+			numBytes = 4;
+			rle[b++] = 0; // two-byte length indicator
+			rle[b++] = (uint8_t)runLength;
+			rle[b++] = (uint8_t)(runLength >> 8);
+		}
+		else
+		{
+			numBytes = 2;
+			rle[b++] = (uint8_t)runLength;
+		}
+
+		// encode the block type of the run
+		rle[b++] = runBlock;
+
+		// track the total size and number of runs
+		info.numBytes += numBytes;
+		info.numRuns++;
+
+		// start next run
+		runLength = 1;
+		runBlock = curBlock;
+	}
+
+	return info;
+}
+
+// Fills in the raw blocks of a chunk from RLE.
+// Caller is responsible for managing both of the buffers.
+void Rle_DecodeChunk(uint8_t *raw, const uint8_t *rle, RleInfo info)
+{
+	const int sideSize = 64;
+	const int fullSize = sideSize * sideSize * sideSize;
+	int n = 0; // number of blocks written to the chunk
+	int b = 0; // byte index of rle
+
+	for (int i = 0; i < info.numRuns; i++)
+	{
+		uint8_t firstByte = rle[b++];
+		int runLength;
+
+		// decode the run length, which uses a variable number of bytes
+		if (firstByte == 0xff)
+		{
+			runLength = rle[b++];
+			runLength |= ((int)rle[b++]) << 8;
+			runLength |= ((int)rle[b++]) << 16;
+			runLength |= ((int)rle[b++]) << 24;
+		}
+		else if (firstByte == 0)
+		{
+			runLength = rle[b++];
+			runLength |= ((int)rle[b++]) << 8;
+		}
+		else
+		{
+			runLength = firstByte;
+		}
+
+		// decode the block type of the run
+		uint8_t runType = rle[b++];
+
+		if (n >= fullSize)
+		{
+			printf("Error: Too many runs in the chunk.\n");
+			break;
+		}
+
+		if (n + runLength > fullSize)
+		{
+			printf("Error: A run is too long for the chunk.\n");
+			runLength = fullSize - n;
+		}
+
+		// fill in the raw block data
+		memset(raw, runType, runLength);
+		raw += runLength;
+		n += runLength;
+	}
+
+	if (b != info.numBytes)
+		printf("Error: Corrupt RLE data.\n");
+
+	if (n < fullSize)
+	{
+		printf("Error: Incomplete chunk.\n");
+		memset(raw, BLOCK_AIR, fullSize - n);
+	}
+}
+
+enum
+{
+	RLE_SCALAR_ENCODE,
+	RLE_FAST_ENCODE,
+	RLE_SCALAR_DECODE,
+	RLE_FAST_DECODE,
+	NUM_RLE_TIMINGS,
+};
+
+typedef struct
+{
+	CodecContext codec;
+	uint8_t *rle; // output of the fast encoder
+	uint8_t *expected;
+	BlockStorage reference;
+	BlockStorage decoded;
+	int numChunks;
+	int numErrors;
+	uint64_t numRuns;
+	uint64_t ticks[NUM_RLE_TIMINGS];
+} RleBenchmark;
+
+static bool SameStorage(const BlockStorage *a, const BlockStorage *b)
+{
+	if (a->paletteSize != b->paletteSize || a->bits != b->bits) return false;
+	if (memcmp(a->palette, b->palette, a->paletteSize) != 0) return false;
+	return a->bits == 0 || memcmp(a->data, b->data, ((size_t)BLOCKS_PER_CHUNK * a->bits) / 8) == 0;
+}
+
+// Decodes RLE both ways, and checks that the results match each other and, if given, the expected blocks.
+static bool CheckRleDecode(RleBenchmark *bench, const uint8_t *rle, RleInfo info, const uint8_t *expected)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	Rle_DecodeChunk(bench->codec.raw, rle, info);
+	Blocks_Pack(&bench->reference, bench->codec.raw);
+	Uint64 middle = SDL_GetPerformanceCounter();
+	Rle_DecodeBlocks(&bench->decoded, rle, info);
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	bench->ticks[RLE_SCALAR_DECODE] += middle - start;
+	bench->ticks[RLE_FAST_DECODE] += end - middle;
+
+	if (!SameStorage(&bench->reference, &bench->decoded)) return false;
+	if (expected == NULL) return true;
+
+	Blocks_Unpack(&bench->decoded, bench->codec.raw);
+	return memcmp(bench->codec.raw, expected, BLOCKS_PER_CHUNK) == 0;
+}
+
+// Round trips one chunk through both encoders and both decoders, which must all agree.
+static void BenchmarkRleChunk(RleBenchmark *bench, const BlockStorage *blocks)
+{
+	Blocks_Unpack(blocks, bench->expected);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	RleInfo scalar = Rle_EncodeChunkScalar(blocks, bench->codec.rle);
+	Uint64 middle = SDL_GetPerformanceCounter();
+	RleInfo fast = Rle_EncodeChunk(blocks, bench->rle);
+	Uint64 end = SDL_GetPerformanceCounter();
+
+	bench->ticks[RLE_SCALAR_ENCODE] += middle - start;
+	bench->ticks[RLE_FAST_ENCODE] += end - middle;
+	bench->numRuns += scalar.numRuns;
+	bench->numChunks++;
+
+	bool same = scalar.numBytes == fast.numBytes && scalar.numRuns == fast.numRuns
+		&& memcmp(bench->codec.rle, bench->rle, scalar.numBytes) == 0;
+
+	if (!same || !CheckRleDecode(bench, bench->rle, fast, bench->expected)) bench->numErrors++;
+}
+
+// Makes chunks of random runs, with lengths from 1 to twice the mean, of random types out of the first numTypes.
+static void BenchmarkSyntheticChunks(RleBenchmark *bench)
+{
+	static const int typeCounts[] = { 2, 3, 5, 16, 17, 255 };
+	static const int meanRuns[] = { 1, 4, 37, 1000, 100000 };
+	const int numTypeCounts = sizeof(typeCounts) / sizeof(typeCounts[0]);
+	const int numMeanRuns = sizeof(meanRuns) / sizeof(meanRuns[0]);
+	BlockStorage blocks = { 0 };
+	srand(1);
+
+	for (int t = 0; t < numTypeCounts; t++)
+	{
+		for (int m = 0; m < numMeanRuns; m++)
+		{
+			for (int i = 0; i < BLOCKS_PER_CHUNK;)
+			{
+				int runLength = 1 + (rand() % (2 * meanRuns[m]));
+				if (runLength > BLOCKS_PER_CHUNK - i) runLength = BLOCKS_PER_CHUNK - i;
+
+				memset(bench->codec.raw + i, rand() % typeCounts[t], runLength);
+				i += runLength;
+			}
+
+			Blocks_Pack(&blocks, bench->codec.raw);
+			BenchmarkRleChunk(bench, &blocks);
+		}
+	}
+
+	Blocks_Fill(&blocks, BLOCK_AIR);
+	BenchmarkRleChunk(bench, &blocks);
+	Blocks_Free(&blocks);
+}
+
+// Breaks the RLE of a chunk in the ways the decoders check for, which must give the same blocks both ways.
+// Each case prints its errors twice, once per decoder.
+static void BenchmarkBrokenRle(RleBenchmark *bench)
+{
+	for (int i = 0; i < BLOCKS_PER_CHUNK; i++)
+		bench->codec.raw[i] = (i / 37) % 5;
+
+	Blocks_Pack(&bench->reference, bench->codec.raw);
+	RleInfo info = Rle_EncodeChunk(&bench->reference, bench->rle);
+	int numErrors = 0;
+
+	// one run too few, so the chunk is incomplete and the data has bytes left over
+	RleInfo missing = info;
+	missing.numRuns--;
+	if (!CheckRleDecode(bench, bench->rle, missing, NULL)) numErrors++;
+
+	// one run too many
+	RleInfo extra = info;
+	bench->rle[extra.numBytes++] = 1;
+	bench->rle[extra.numBytes++] = BLOCK_AIR;
+	extra.numRuns++;
+	if (!CheckRleDecode(bench, bench->rle, extra, NULL)) numErrors++;
+
+	printf("broken RLE: %d errors\n", numErrors);
+	memset(bench->ticks, 0, sizeof(bench->ticks));
+}
+
+static void BenchmarkRleRegionFile(const RegionFile *rf, const ArchivedRegion *region, void *data)
+{
+	RleBenchmark *bench = data;
+	BlockStorage blocks = { 0 };
+
+	for (int i = 0; i < rf->numChunks; i++)
+	{
+		if (!RegionFile_ReadChunk(rf, i, &blocks, &bench->codec)) break;
+		if (!Blocks_IsUniform(&blocks)) BenchmarkRleChunk(bench, &blocks);
+	}
+
+	Blocks_Free(&blocks);
+}
+
+static void PrintRleBenchmark(RleBenchmark *bench, const char *name)
+{
+	static const char *names[NUM_RLE_TIMINGS] = { "encode", "fast encode", "decode", "fast decode" };
+	double frequency = (double)SDL_GetPerformanceFrequency();
+
+	printf("%s: %d chunks, %.1f runs per chunk, %d errors\n", name, bench->numChunks,
+		(double)bench->numRuns / bench->numChunks, bench->numErrors);
+
+	for (int t = 0; t < NUM_RLE_TIMINGS; t++)
+	{
+		double seconds = bench->ticks[t] / frequency;
+		printf("  %-12s %10.1f us/chunk %10.1f MB/s\n", names[t], seconds * 1e6 / bench->numChunks,
+			(double)bench->numChunks * BLOCKS_PER_CHUNK / seconds / 1e6);
+	}
+
+	memset(bench->ticks, 0, sizeof(bench->ticks));
+	bench->numChunks = 0;
+	bench->numErrors = 0;
+	bench->numRuns = 0;
+}
+
+// Checks that the fast RLE encoder and decoder give the same results as the scalar ones, and compares their speed,
+// on random chunks and on the saved non-uniform chunks of a world folder. Scalar decoding includes packing the blocks.
+void Rle_Benchmark(char *folderPath)
+{
+	RleBenchmark bench = { 0 };
+	CodecContext_Init(&bench.codec);
+	bench.rle = malloc(REGION_RLE_BUFFER_SIZE + 2);
+	bench.expected = malloc(BLOCKS_PER_CHUNK);
+
+	BenchmarkBrokenRle(&bench);
+	BenchmarkSyntheticChunks(&bench);
+	PrintRleBenchmark(&bench, "random chunks");
+
+	ArchiveSet *set = Archive_OpenSet(folderPath);
+	Region_VisitArchives(set, BenchmarkRleRegionFile, &bench);
+	Archive_CloseSet(set);
+	if (bench.numChunks > 0) PrintRleBenchmark(&bench, folderPath);
+
+	Blocks_Free(&bench.reference);
+	Blocks_Free(&bench.decoded);
+	CodecContext_Free(&bench.codec);
+	free(bench.rle);
+	free(bench.expected);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blocks.h"
+
+typedef struct
+{
+	uint32_t numBytes;
+	uint32_t numRuns;
+} RleInfo;
+
+RleInfo Rle_EncodeChunk(const BlockStorage *blocks, uint8_t *rle);
+void Rle_DecodeBlocks(BlockStorage *blocks, const uint8_t *rle, RleInfo info);
+
+// The original byte-at-a-time versions, kept as a reference for the benchmark
+RleInfo Rle_EncodeChunkScalar(const BlockStorage *blocks, uint8_t *rle);
+void Rle_DecodeChunk(uint8_t *raw, const uint8_t *rle, RleInfo info);
+void Rle_Benchmark(char *folderPath);
@@ -69,6 +69,135 @@ uint64_t ListUInt64Pop(ListUInt64* list)
 	return 0;
 }
 
+// Ascending order comparison for qsort.
+int CompareUInt64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Mixes the bits of a key so that nearby coords land in different slots (splitmix64 finalizer).
+static inline size_t HashUInt64(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ull;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebull;
+	key ^= key >> 31;
+	return (size_t)key;
+}
+
+// Capacity is rounded up to a power of two.
+void HashMapUInt64Init(HashMapUInt64* map, size_t capacity)
+{
+	size_t c = 16;
+	while (c < capacity) c <<= 1;
+
+	map->keys = calloc(c, sizeof(uint64_t));
+	map->values = calloc(c, sizeof(uint64_t));
+	map->capacity = c;
+	map->size = 0;
+}
+
+void HashMapUInt64Free(HashMapUInt64* map)
+{
+	free(map->keys);
+	free(map->values);
+	map->keys = NULL;
+	map->values = NULL;
+	map->capacity = 0;
+	map->size = 0;
+}
+
+// Returns true and fills in `*value` if the key is present.
+bool HashMapUInt64Get(HashMapUInt64* map, uint64_t key, uint64_t* value)
+{
+	const size_t mask = map->capacity - 1;
+
+	for (size_t i = HashUInt64(key) & mask; map->keys[i] != 0; i = (i + 1) & mask)
+	{
+		if (map->keys[i] == key)
+		{
+			*value = map->values[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void HashMapUInt64Grow(HashMapUInt64* map)
+{
+	HashMapUInt64 bigger;
+	HashMapUInt64Init(&bigger, map->capacity * 2);
+
+	for (size_t i = 0; i < map->capacity; i++)
+	{
+		if (map->keys[i] != 0)
+			HashMapUInt64Set(&bigger, map->keys[i], map->values[i]);
+	}
+
+	HashMapUInt64Free(map);
+	*map = bigger;
+}
+
+// Inserts the key or replaces its value. The key must not be 0.
+void HashMapUInt64Set(HashMapUInt64* map, uint64_t key, uint64_t value)
+{
+	// keep the load factor under 70% so that probe sequences stay short
+	if ((map->size + 1) * 10 > map->capacity * 7)
+		HashMapUInt64Grow(map);
+
+	const size_t mask = map->capacity - 1;
+	size_t i = HashUInt64(key) & mask;
+
+	for (; map->keys[i] != 0; i = (i + 1) & mask)
+	{
+		if (map->keys[i] == key)
+		{
+			map->values[i] = value;
+			return;
+		}
+	}
+
+	map->keys[i] = key;
+	map->values[i] = value;
+	map->size++;
+}
+
+// Removes the key if present. Returns true if it was found.
+bool HashMapUInt64Remove(HashMapUInt64* map, uint64_t key)
+{
+	const size_t mask = map->capacity - 1;
+	size_t i = HashUInt64(key) & mask;
+
+	while (map->keys[i] != key)
+	{
+		if (map->keys[i] == 0) return false;
+		i = (i + 1) & mask;
+	}
+
+	// Shift later entries of the same probe sequence back into the gap, so no tombstones are needed.
+	for (size_t j = (i + 1) & mask; map->keys[j] != 0; j = (j + 1) & mask)
+	{
+		size_t home = HashUInt64(map->keys[j]) & mask;
+
+		// move the entry unless its home slot lies cyclically in (i, j]
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			map->keys[i] = map->keys[j];
+			map->values[i] = map->values[j];
+			i = j;
+		}
+	}
+
+	map->keys[i] = 0;
+	map->values[i] = 0;
+	map->size--;
+	return true;
+}
+
 // truncates vec3 to ivec3
 void GetIntCoords(vec3 fPos, ivec3 iPos)
 {
@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include "cglm/cglm.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #define PROGRESS_MSG_LEN 40
 
 typedef struct
@@ -13,6 +17,16 @@ typedef struct
 	size_t size;
 } ListUInt64;
 
+// Open-addressing hash map from uint64_t keys to uint64_t values.
+// Key 0 is reserved to mark empty slots. Capacity is always a power of two.
+typedef struct
+{
+	uint64_t* keys;
+	uint64_t* values;
+	size_t capacity;
+	size_t size;
+} HashMapUInt64;
+
 typedef enum
 {
 	AXIS_X,
@@ -100,4 +114,22 @@ void ListUInt64Init(ListUInt64* list, size_t capacity);
 void ListUInt64Insert(ListUInt64* list, uint64_t value);
 void ListUInt64RemoveAt(ListUInt64* list, size_t index);
 uint64_t ListUInt64Pop(ListUInt64* list);
+int CompareUInt64(const void* a, const void* b);
+void HashMapUInt64Init(HashMapUInt64* map, size_t capacity);
+void HashMapUInt64Free(HashMapUInt64* map);
+bool HashMapUInt64Get(HashMapUInt64* map, uint64_t key, uint64_t* value);
+void HashMapUInt64Set(HashMapUInt64* map, uint64_t key, uint64_t value);
+bool HashMapUInt64Remove(HashMapUInt64* map, uint64_t key);
 void GetIntCoords(vec3 fPos, ivec3 iPos);
+
+// Returns the index of the lowest set bit. x must not be 0.
+static inline int CountTrailingZeros64(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
@@ -17,8 +17,11 @@
 #include "compress.h"
 #include "lod.h"
 #include "filesystem.h"
+#include "writer.h"
+#include "readbatch.h"
+#include "archive.h"
 
-static void LoadRegion(Region *region);
+static void LoadRegion(CodecContext *codec, Region *region);
 
 static void Align(ivec3 coords, int alignment)
 {
@@ -30,18 +33,6 @@ static void Align(ivec3 coords, int alignment)
 	coords[2] -= mod < 0 ? mod + alignment : mod;
 }
 
-static inline int NumChunksInRegion(int lodLevel)
-{
-	switch (lodLevel)
-	{
-		case 0: return 512;
-		case 1: return 64;
-		case 2: return 8;
-		case 3: return 1;
-		default: return 1;
-	}
-}
-
 static void Coords_ApplyMortonOffset(ivec3 base, int morton, int lodLevel, ivec3 result)
 {
 	int alignment = 1 << lodLevel;
@@ -54,6 +45,27 @@ static void Coords_ApplyMortonOffset(ivec3 base, int morton, int lodLevel, ivec3
 	result[2] = base[2] + (z * alignment);
 }
 
+// Chunks are stored in z-order of their offsets from the base coords of their region.
+static inline int ChunkIndexInRegion(ivec3 baseCoords, ivec3 coords, int lodLevel)
+{
+	int x = (coords[0] - baseCoords[0]) >> lodLevel;
+	int y = (coords[1] - baseCoords[1]) >> lodLevel;
+	int z = (coords[2] - baseCoords[2]) >> lodLevel;
+	return GetMortonCode(x, y, z);
+}
+
+// Packs chunk or region coords and an LOD level into a hash key. Each coord keeps its low 20 bits.
+// The LOD level is offset by one so that the key is never 0, which the hash map reserves.
+static inline uint64_t CoordsKey(ivec3 coords, int lodLevel)
+{
+	const uint64_t mask = 0xfffff;
+
+	return ((uint64_t)(lodLevel + 1) << 60)
+		| (((uint64_t)coords[2] & mask) << 40)
+		| (((uint64_t)coords[1] & mask) << 20)
+		| ((uint64_t)coords[0] & mask);
+}
+
 // Frees a region and all of its chunks.
 static void DestroyRegion(Region *region)
 {
@@ -64,6 +76,7 @@ static void DestroyRegion(Region *region)
 		Chunk *c = region->chunks + i;
 		SDL_DestroyMutex(c->mutex);
 		free(c->quads.values);
+		Blocks_Free(&c->blocks);
 	}
 
 	SDL_DestroyMutex(region->mutex);
@@ -77,23 +90,47 @@ static void ConstructChunk(Chunk *chunk, World *world, ivec3 coords, int lodLeve
 	chunk->world = world;
 	chunk->flags = CHUNK_DIRTY;
 	chunk->lodLevel = lodLevel;
+	chunk->activeIndex = -1;
+	Blocks_Fill(&chunk->blocks, BLOCK_AIR);
+	memset(chunk->neighborLods, -1, sizeof(chunk->neighborLods));
 	ListUInt64Init(&chunk->quads, 64);
 	glm_ivec3_copy(coords, chunk->coords);
 }
 
+// Size of a region's structs. Block data is allocated separately once the region is loaded.
+static inline size_t RegionMemorySize(int numChunks)
+{
+	return sizeof(Region) + (numChunks * sizeof(Chunk));
+}
+
+static size_t RegionBlockMemorySize(Region *region)
+{
+	size_t size = 0;
+
+	for (int i = 0; i < region->numChunks; i++)
+		size += Blocks_MemorySize(&region->chunks[i].blocks);
+
+	return size;
+}
+
 // Initializes a Region struct and all of its chunks without loading block data.
 static Region *ConstructRegion(World *world, ivec3 baseCoords, int lodLevel)
 {
 	ivec3 coords;
 	int numChunks = NumChunksInRegion(lodLevel);
-	size_t size = sizeof(Region) + (numChunks * sizeof(Chunk));
-	Region *region = calloc(1, size);
+	Region *region = calloc(1, RegionMemorySize(numChunks));
 	region->mutex = SDL_CreateMutex();
 	region->chunks = (void *)(region + 1);
 	region->world = world;
 	region->lodLevel = lodLevel;
 	region->numChunks = numChunks;
+	region->numActive = 0;
+	region->queueIndex = -1;
+	region->loading = false;
 	region->loaded = false;
+	region->dead = false;
+	region->modified = false;
+	region->memorySize = RegionMemorySize(numChunks);
 	glm_ivec3_copy(baseCoords, region->baseCoords);
 
 	for (int i = 0; i < numChunks; i++)
@@ -101,19 +138,34 @@ static Region *ConstructRegion(World *world, ivec3 baseCoords, int lodLevel)
 		Chunk *chunk = region->chunks + i;
 		Coords_ApplyMortonOffset(baseCoords, i, lodLevel, coords);
 		ConstructChunk(chunk, world, coords, lodLevel);
+		chunk->region = region;
 	}
 
 	return region;
 }
 
-static inline void SetBlock(Chunk* chunk, int x, int y, int z, uint8_t type)
+static inline void SetBlock(uint8_t* raw, int x, int y, int z, uint8_t type)
 {
 	int m = GetMortonCode(x, y, z);
-	chunk->blocks[m] = type;
+	raw[m] = type;
+}
+
+// Mixes the world seed and a block column into a pseudo-random number. Generating a chunk again
+// gives the same trees, so a coarser region condensed from another copy of it still matches.
+static inline uint32_t HashColumn(uint64_t seed, int x, int z)
+{
+	uint32_t h = (uint32_t)seed ^ (uint32_t)(seed >> 32);
+	h ^= (uint32_t)x * 0x9e3779b1u;
+	h = (h ^ (h >> 15)) * 0x85ebca77u;
+	h ^= (uint32_t)z * 0xc2b2ae3du;
+	h = (h ^ (h >> 13)) * 0x27d4eb2fu;
+	return h ^ (h >> 16);
 }
 
 // Generates block data with the help of Perlin noise.
-static void GenerateChunk(Chunk* chunk)
+// raw is scratch space for BLOCKS_PER_CHUNK block types, which are packed into the chunk at the end.
+// noise2D holds the terrain heights of the chunk's column, from Noise_Generate2D.
+static void GenerateChunk(Chunk* chunk, const uint8_t* noise2D, uint8_t* raw)
 {
 	if (chunk->lodLevel != 0)
 	{
@@ -126,12 +178,33 @@ static void GenerateChunk(Chunk* chunk)
 	int cy = chunk->coords[1];
 	int cz = chunk->coords[2];
 	int minY = cy * 64;
-	float p = 0.0f;
 	NoiseMaker* nm = &chunk->world->noiseMaker;
-
-	uint8_t* noise2D = Noise_Generate2D(nm, cx, cz, &p);
 	//uint8_t* noise3D = Noise_Generate3D(nm, cx, cy, cz, &p);
 
+	int minHeight = 255, maxHeight = 0;
+	for (int i = 0; i < 64 * 64; i++)
+	{
+		if (noise2D[i] < minHeight) minHeight = noise2D[i];
+		if (noise2D[i] > maxHeight) maxHeight = noise2D[i];
+	}
+
+	// Chunks entirely above the terrain (and its trees) or entirely in the stone below it are a single type.
+	uint8_t uniformType = BLOCK_AIR;
+	bool uniform = maxHeight - 128 < minY;
+
+	if (minHeight - 128 - 10 > minY + 63)
+	{
+		uniformType = BLOCK_STONE;
+		uniform = true;
+	}
+
+	if (uniform)
+	{
+		Blocks_Fill(&chunk->blocks, uniformType);
+		chunk->flags |= CHUNK_LOADED | CHUNK_GENERATED;
+		return;
+	}
+
 	for (int z = 0; z < 64; z++)
 	{
 		for (int x = 0; x < 64; x++)
@@ -152,7 +225,7 @@ static void GenerateChunk(Chunk* chunk)
 				else if (wy < height - 2) type = BLOCK_DIRT;
 				else if (wy < height) type = BLOCK_GRASS;
 
-				SetBlock(chunk, x, y, z, type);
+				SetBlock(raw, x, y, z, type);
 			}
 		}
 	}
@@ -165,69 +238,227 @@ static void GenerateChunk(Chunk* chunk)
 
 			if (height >= minY && height < minY + 56 &&
 				x > 1 && x < 62 && z > 1 && z < 62 &&
-				(rand() % 360) == 0)
+				(HashColumn(nm->seed, (cx * 64) + x, (cz * 64) + z) % 360) == 0)
 			{
 				height -= minY;
 
 				for (int h = height; h < height + 6; h++)
-					SetBlock(chunk, x, h, z, BLOCK_LOG);
+					SetBlock(raw, x, h, z, BLOCK_LOG);
 
 				for (int w = 0; w < 3; w++)
 					for (int u = x - 2 + w; u <= x + 2 - w; u++)
 						for (int v = z - 2 + w; v <= z + 2 - w; v++)
-							SetBlock(chunk, u, height + 6 + w, v, BLOCK_LEAVES);
+							SetBlock(raw, u, height + 6 + w, v, BLOCK_LEAVES);
 			}
 		}
 	}
 
+	Blocks_Pack(&chunk->blocks, raw);
 	chunk->flags |= CHUNK_LOADED | CHUNK_GENERATED;
-	free(noise2D);
 	//free(noise3D);
 
 	//ticks = SDL_GetTicks() - ticks;
 	//printf("Chunk gen took %d ms.\n", ticks);
 }
 
-// Generates new block data for a whole region and any subregions.
-static void GenerateRegion(Region *region)
+// Generates a chunk coarser than the region level straight from the terrain noise, with one height sample
+// for each column of its blocks. Condensing it would take the L0 chunks of thousands of regions.
+// The top block of each column is grass, so distant terrain has the color of the surface. Trees are too small to show.
+static void GenerateCoarseChunk(Chunk *chunk, uint8_t *raw)
+{
+	int scale = 1 << chunk->lodLevel; // size of its blocks in L0 blocks
+	int minY = chunk->coords[1] * 64;
+	float p = 0.0f;
+	NoiseMaker *nm = &chunk->world->noiseMaker;
+
+	uint8_t *noise2D = Noise_Generate2DLod(nm, chunk->coords[0], chunk->coords[2], chunk->lodLevel, &p);
+
+	int minHeight = 255, maxHeight = 0;
+	for (int i = 0; i < 64 * 64; i++)
+	{
+		if (noise2D[i] < minHeight) minHeight = noise2D[i];
+		if (noise2D[i] > maxHeight) maxHeight = noise2D[i];
+	}
+
+	// Blocks are solid where their center is below the terrain. Most coarse chunks are all above or all below it.
+	int lowestCenter = minY + (scale / 2);
+	int highestCenter = minY + (63 * scale) + (scale / 2);
+	bool uniform = maxHeight - 128 <= lowestCenter;
+	uint8_t uniformType = BLOCK_AIR;
+
+	if (highestCenter + scale < minHeight - 128 - 10)
+	{
+		uniformType = BLOCK_STONE;
+		uniform = true;
+	}
+
+	if (uniform)
+	{
+		Blocks_Fill(&chunk->blocks, uniformType);
+		chunk->flags |= CHUNK_LOADED | CHUNK_GENERATED;
+		free(noise2D);
+		return;
+	}
+
+	for (int z = 0; z < 64; z++)
+	{
+		for (int x = 0; x < 64; x++)
+		{
+			int height = noise2D[(z * 64) + x] - 128;
+
+			for (int y = 0; y < 64; y++)
+			{
+				int wy = minY + (y * scale) + (scale / 2);
+				uint8_t type = BLOCK_AIR;
+
+				if (wy < height && wy + scale >= height) type = BLOCK_GRASS;
+				else if (wy < height - 10) type = BLOCK_STONE;
+				else if (wy < height) type = BLOCK_DIRT;
+
+				SetBlock(raw, x, y, z, type);
+			}
+		}
+	}
+
+	Blocks_Pack(&chunk->blocks, raw);
+	chunk->flags |= CHUNK_LOADED | CHUNK_GENERATED;
+	free(noise2D);
+}
+
+// Returns the region with these base coords and LOD level if it is loaded, or NULL. The region can't be freed
+// until it is unpinned, but the main thread may still change its block data.
+static Region *PinLoadedRegion(World *world, ivec3 baseCoords, int lodLevel)
+{
+	Region *region = NULL;
+	uint64_t value;
+
+	SDL_LockMutex(world->mutex);
+
+	if (HashMapUInt64Get(&world->regionIndex, CoordsKey(baseCoords, lodLevel), &value))
+	{
+		region = (void *)value;
+
+		// until a generation thread lets go of it, some chunks may have no block data yet
+		if (region->loaded && !region->loading) region->numReaders++;
+		else region = NULL;
+	}
+
+	SDL_UnlockMutex(world->mutex);
+	return region;
+}
+
+static void UnpinRegion(World *world, Region *region)
+{
+	SDL_LockMutex(world->mutex);
+	region->numReaders--;
+	SDL_UnlockMutex(world->mutex);
+}
+
+// Generates new block data for a whole region and any subregions, down to level 0. Regions coarser than
+// the region level are generated from the noise at their own scale instead.
+// codec is the calling thread's, which also provides the scratch space for generating chunks.
+static void GenerateRegion(CodecContext *codec, Region *region)
 {
 	World *world = region->world;
 	int lodLevel = region->lodLevel;
 	int numChunks = NumChunksInRegion(lodLevel);
 
-	if (lodLevel == 0)
+	if (lodLevel > REGION_LOD_LEVEL)
 	{
+		GenerateCoarseChunk(region->chunks, codec->raw);
+	}
+	else if (lodLevel == 0)
+	{
+		ivec3 center;
+		SDL_LockMutex(world->mutex);
+		glm_ivec3_copy(world->visibleCenter, center);
+		SDL_UnlockMutex(world->mutex);
+
+		// Generate the chunks nearest to the visible center first. Each chunk is flagged as loaded
+		// as soon as it is generated, so nearby terrain can be meshed before the whole region is done.
+		uint64_t order[numChunks];
+
 		for (int i = 0; i < numChunks; i++)
 		{
-			Chunk *chunk = region->chunks + i;
-			GenerateChunk(chunk);
+			uint64_t d = 0;
+
+			for (int a = 0; a < 3; a++)
+			{
+				int64_t delta = region->chunks[i].coords[a] - center[a];
+				d += delta * delta;
+			}
+
+			order[i] = (d << 32) | i;
 		}
+
+		qsort(order, numChunks, sizeof(uint64_t), CompareUInt64);
+
+		// The chunks stacked in a column of the region share its terrain heights, which are generated for the first of them.
+		const int width = RegionWidth(0);
+		uint8_t *columns[width * width];
+		memset(columns, 0, sizeof(columns));
+
+		for (int i = 0; i < numChunks; i++)
+		{
+			Chunk *chunk = region->chunks + (order[i] & 0xffffffff);
+			int column = ((chunk->coords[2] - region->baseCoords[2]) * width) + (chunk->coords[0] - region->baseCoords[0]);
+			float p = 0.0f;
+
+			if (columns[column] == NULL)
+				columns[column] = Noise_Generate2D(&world->noiseMaker, chunk->coords[0], chunk->coords[2], &p);
+
+			GenerateChunk(chunk, columns[column], codec->raw);
+		}
+
+		for (int c = 0; c < width * width; c++)
+			free(columns[c]);
 	}
 	else
 	{
-		// Load the next-lower-lod-level region. This will recursively load/generate regions until level 0 is reached.
-		// TODO: for now, L3 is the max, and all region files are aligned to L3 coords, hence the same baseCoords being used for the subRegion
-		Region *subRegion = ConstructRegion(world, region->baseCoords, lodLevel - 1);
-		LoadRegion(subRegion);
+		// The next finer region has the same base coords, with 8 chunks for each chunk of this one.
+		// If it is in memory, its chunks are condensed as they are, edits included. Otherwise it is read from disk,
+		// or generated, which recursively goes down to level 0.
+		Region *subRegion = PinLoadedRegion(world, region->baseCoords, lodLevel - 1);
+		bool resident = subRegion != NULL;
+		BlockStorage copies[8] = { 0 };
+
+		if (!resident)
+		{
+			subRegion = ConstructRegion(world, region->baseCoords, lodLevel - 1);
+			LoadRegion(codec, subRegion);
+		}
 
 		for (int i = 0; i < numChunks; i++)
 		{
 			// subRegion has 8 times as many chunks
 			int subChunkStart = i * 8;
 			Chunk *chunk = region->chunks + i;
-			uint8_t *blocks[8];
+			BlockStorage *blocks[8];
 
 			for (int m = 0; m < 8; m++)
 			{
 				Chunk *subChunk = subRegion->chunks + subChunkStart + m;
-				blocks[m] = subChunk->blocks;
+				blocks[m] = &subChunk->blocks;
+
+				// the main thread may be changing the block data of a region in memory
+				if (resident)
+				{
+					SDL_LockMutex(subChunk->mutex);
+					Blocks_Copy(copies + m, &subChunk->blocks);
+					SDL_UnlockMutex(subChunk->mutex);
+					blocks[m] = copies + m;
+				}
 			}
 
-			Lod_Generate(blocks, chunk->blocks);
+			Lod_Generate(blocks, &chunk->blocks);
 			chunk->flags |= CHUNK_LOADED | CHUNK_GENERATED;
 		}
 
-		DestroyRegion(subRegion);
+		for (int m = 0; m < 8; m++)
+			Blocks_Free(copies + m);
+
+		if (resident) UnpinRegion(world, subRegion);
+		else DestroyRegion(subRegion);
 	}
 }
 
@@ -237,169 +468,472 @@ static inline void CoordsToString(char *buffer, ivec3 coords)
 	sprintf(buffer, "%+04d_%+04d_%+04d", coords[0], coords[1], coords[2]);
 }
 
-// Fills in the buffer with the region's file path. Also creates directories as needed.
-static void GetRegionFilePath(Region *region, char *buffer)
+// Fills in the path the region's file had before archives, in a directory per L3 region.
+static void GetLegacyRegionPath(Region *region, char *buffer)
 {
-	char *dirs[2];
 	char subdirL3[20];
-	char filename[2] = { '0' + region->lodLevel, '\0' };
-
-	dirs[0] = region->world->folderPath;
-	dirs[1] = subdirL3;
-
 	const int alignment = 1 << 3;
 	ivec3 alignedCoords;
 	glm_ivec3_copy(region->baseCoords, alignedCoords);
 	Align(alignedCoords, alignment);
 	CoordsToString(subdirL3, alignedCoords);
 
-	PathBuilder path;
-	path.dirs = dirs;
-	path.file = filename;
-	path.ext = ".chunk";
-	path.numDirs = 2;
+	snprintf(buffer, PATH_FULLMAXLEN, "%s/%s/%d.chunk", region->world->folderPath, subdirL3, region->lodLevel);
+}
+
+// Hands a snapshot of a region's block data to the region writer.
+// With move, the chunks give up their block data instead, which is only safe once nothing else can read it.
+// region->modified is left to the caller. Only the main thread makes edits, so only it can clear the flag
+// without losing an edit that comes in after the snapshot.
+static void SaveRegion(Region *region, bool move)
+{
+	BlockStorage *blocks = calloc(region->numChunks, sizeof(BlockStorage));
 
-	Path_BuildStrAndMakeDirs(buffer, path);
+	for (int i = 0; i < region->numChunks; i++)
+	{
+		Chunk *chunk = region->chunks + i;
+
+		if (move)
+		{
+			blocks[i] = chunk->blocks;
+			chunk->blocks.data = NULL;
+		}
+		else
+		{
+			// the main thread may be setting blocks in loaded chunks
+			SDL_LockMutex(chunk->mutex);
+			Blocks_Copy(blocks + i, &chunk->blocks);
+			SDL_UnlockMutex(chunk->mutex);
+		}
+	}
+
+	RegionWriter_Save(region->world->writer, region->baseCoords, region->lodLevel, region->world->regionCodec, blocks, region->numChunks);
+}
+
+// Reads the block data of regions from disk, with one batch of reads for all of them.
+// Regions that are waiting to be written are read from the writer's queue instead of their outdated archives,
+// and regions that aren't in an archive yet from their file in the old layout. Regions with neither are left unloaded.
+static void ReadRegions(CodecContext *codec, World *world, Region **regions, int numRegions)
+{
+	char paths[numRegions][PATH_FULLMAXLEN];
+	FileRead reads[numRegions];
+	bool archived[numRegions];
+
+	for (int i = 0; i < numRegions; i++)
+	{
+		reads[i].path = NULL;
+		reads[i].offset = 0;
+		reads[i].size = 0;
+		archived[i] = false;
+		if (regions[i]->loaded || RegionWriter_ReadPending(world->writer, regions[i])) continue;
+
+		archived[i] = Archive_BeginRead(world->archives, regions[i]->baseCoords, regions[i]->lodLevel, paths[i], reads + i);
+
+		if (!archived[i])
+		{
+			GetLegacyRegionPath(regions[i], paths[i]);
+			reads[i].path = paths[i];
+		}
+	}
+
+	ReadBatch_Read(reads, numRegions, world->readBackend);
+
+	for (int i = 0; i < numRegions; i++)
+	{
+		if (archived[i]) Archive_EndRead(world->archives, regions[i]->baseCoords);
+		if (reads[i].data != NULL) Region_ReadMemory(codec, regions[i], reads[i].data, reads[i].size, paths[i]);
+	}
+
+	ReadBatch_Free(reads, numRegions);
+}
+
+// Generates a region that couldn't be read from disk, unless another thread has loaded it meanwhile.
+// Caller must hold region->mutex.
+static void GenerateMissingRegion(CodecContext *codec, Region *region)
+{
+	if (region->loaded) return;
+
+	GenerateRegion(codec, region);
+	SaveRegion(region, false);
+	region->loaded = true;
 }
 
 // Reads block data from disk or generates the region from scratch.
-static void LoadRegion(Region *region)
+static void LoadRegion(CodecContext *codec, Region *region)
 {
 	SDL_LockMutex(region->mutex);
-	if (region->loaded)
+	ReadRegions(codec, region->world, &region, 1);
+	GenerateMissingRegion(codec, region);
+	SDL_UnlockMutex(region->mutex);
+}
+
+// Lower value means higher priority: squared distance from the region's center (in L0 chunks)
+// to the visible center, with the LOD level as a tie breaker so that finer regions go first.
+static uint64_t RegionPriority(World *world, Region *region)
+{
+	uint64_t d = 0;
+
+	for (int a = 0; a < 3; a++)
 	{
-		SDL_UnlockMutex(region->mutex);
-		return;
+		int64_t delta = region->baseCoords[a] + (RegionWidth(region->lodLevel) / 2) - world->visibleCenter[a];
+		d += delta * delta;
 	}
 
-	char regionFilePath[100];
-	GetRegionFilePath(region, regionFilePath);
-	Region_Read(region, regionFilePath);
+	return (d << 4) | region->lodLevel;
+}
+
+static inline Region *QueuedRegion(World *world, int i)
+{
+	return (void *)world->jobQueue.values[i];
+}
 
-	if (!region->loaded)
+static inline void SetQueuedRegion(World *world, int i, Region *region)
+{
+	world->jobQueue.values[i] = (uint64_t)region;
+	region->queueIndex = i;
+}
+
+static void SiftUp(World *world, int i)
+{
+	Region *region = QueuedRegion(world, i);
+
+	while (i > 0)
 	{
-		GenerateRegion(region);
-		Region_Write(region, regionFilePath);
-		region->loaded = true;
+		int parent = (i - 1) / 2;
+		Region *p = QueuedRegion(world, parent);
+		if (p->priority <= region->priority) break;
+		SetQueuedRegion(world, i, p);
+		i = parent;
 	}
 
-	SDL_UnlockMutex(region->mutex);
+	SetQueuedRegion(world, i, region);
 }
 
-// Loads or generates regions that have been added to the region list.
+static void SiftDown(World *world, int i)
+{
+	int n = world->jobQueue.size;
+	Region *region = QueuedRegion(world, i);
+
+	while (true)
+	{
+		int child = (2 * i) + 1;
+		if (child >= n) break;
+		if (child + 1 < n && QueuedRegion(world, child + 1)->priority < QueuedRegion(world, child)->priority) child++;
+
+		Region *c = QueuedRegion(world, child);
+		if (region->priority <= c->priority) break;
+		SetQueuedRegion(world, i, c);
+		i = child;
+	}
+
+	SetQueuedRegion(world, i, region);
+}
+
+// Adds a region to the job queue and wakes up a generation thread. Caller must hold the world mutex.
+static void QueueRegion(World *world, Region *region)
+{
+	region->priority = RegionPriority(world, region);
+	ListUInt64Insert(&world->jobQueue, (uint64_t)region);
+	SiftUp(world, world->jobQueue.size - 1);
+	SDL_CondSignal(world->jobCond);
+}
+
+// Takes a region out of the job queue, wherever it is. Caller must hold the world mutex.
+static void UnqueueRegion(World *world, Region *region)
+{
+	int i = region->queueIndex;
+	if (i < 0) return;
+
+	region->queueIndex = -1;
+	Region *last = (void *)ListUInt64Pop(&world->jobQueue);
+	if (last == region) return;
+
+	SetQueuedRegion(world, i, last);
+	SiftDown(world, i);
+	SiftUp(world, last->queueIndex);
+}
+
+// Recalculates all priorities after the visible center moves. Caller must hold the world mutex.
+static void ReprioritizeQueue(World *world)
+{
+	int n = world->jobQueue.size;
+
+	for (int i = 0; i < n; i++)
+	{
+		Region *region = QueuedRegion(world, i);
+		region->priority = RegionPriority(world, region);
+	}
+
+	for (int i = (n / 2) - 1; i >= 0; i--)
+		SiftDown(world, i);
+}
+
+// Claims the nearest region, and more after it while the other threads still have enough left,
+// so that their files can be read in one batch. Caller must hold the world mutex.
+static int ClaimRegions(World *world, Region **regions)
+{
+	int numRegions = 0;
+
+	// Popping a region claims it while the world mutex is held, so no other thread can take it,
+	// and it won't be freed until the loading flag is cleared.
+	do {
+		Region *region = QueuedRegion(world, 0);
+		UnqueueRegion(world, region);
+		region->loading = true;
+		regions[numRegions++] = region;
+	} while (numRegions < REGION_READ_BATCH && world->jobQueue.size > NUM_CHUNK_THREADS);
+
+	return numRegions;
+}
+
+// Releases a claimed region. One that is still unloaded goes back into the queue.
+static void FinishRegion(World *world, Region *region)
+{
+	size_t blockMemory = RegionBlockMemorySize(region);
+
+	SDL_LockMutex(world->mutex);
+	region->loading = false;
+
+	// A region that was killed meanwhile has already been taken off the books. This thread may have overwritten
+	// CHUNK_DEAD in its chunks while setting their own flags, so the region keeps its own record.
+	if (!region->dead)
+	{
+		if (region->loaded)
+		{
+			region->memorySize += blockMemory;
+			world->memoryUsed += blockMemory;
+		}
+		else
+		{
+			QueueRegion(world, region);
+		}
+	}
+
+	world->dirty = true;
+	SDL_UnlockMutex(world->mutex);
+}
+
+// Condenses the finer chunks that changed into their coarser chunk.
+typedef struct
+{
+	Chunk *chunk; // the coarser chunk
+	uint8_t octants; // bits of the finer chunks that changed, in z-order
+	BlockStorage children[8]; // copies of those finer chunks
+	BlockStorage result; // starts as a copy of the coarser chunk
+} LodJob;
+
+static void RunLodJob(LodJob *job)
+{
+	BlockStorage *blocks[8];
+
+	for (int m = 0; m < 8; m++)
+		blocks[m] = job->children + m;
+
+	Lod_Update(blocks, job->octants, &job->result);
+
+	for (int m = 0; m < 8; m++)
+		Blocks_Free(job->children + m);
+}
+
+// Loads or generates regions from the job queue, nearest first, and runs LOD jobs.
+// Only the nearest region of each batch is generated if it has no file. The others go back into the queue,
+// so that generating them is shared with the other threads.
 // This runs in a dedicated thread.
 static int RegionGenThread(void* threadData)
 {
 	World* world = threadData;
+	CodecContext codec;
+	CodecContext_Init(&codec);
 
-	while (world->alive)
+	while (true)
 	{
-		Region* region = NULL;
+		SDL_LockMutex(world->mutex);
+
+		while (world->alive && world->jobQueue.size == 0 && world->lodJobs.size == 0)
+			SDL_CondWait(world->jobCond, world->mutex);
+
+		if (!world->alive)
+		{
+			SDL_UnlockMutex(world->mutex);
+			break;
+		}
 
-		if (world->dirty)
+		// LOD jobs are quick, and go first so that edits show up at a distance soon
+		if (world->lodJobs.size > 0)
 		{
-			ListUInt64 regionList = world->regions;
+			LodJob *job = (void *)ListUInt64Pop(&world->lodJobs);
+			SDL_UnlockMutex(world->mutex);
+			RunLodJob(job);
 
 			SDL_LockMutex(world->mutex);
-			for (int i = 0; i < regionList.size; i++)
-			{
-				Region *r = (void *)regionList.values[i];
-				if (!r->loaded) { region = r; break; }
-			}
+			ListUInt64Insert(&world->lodResults, (uint64_t)job);
+			world->dirty = true;
 			SDL_UnlockMutex(world->mutex);
+			continue;
 		}
 
-		if (region == NULL) SDL_Delay(200);
-		else LoadRegion(region);
+		Region *regions[REGION_READ_BATCH];
+		int numRegions = ClaimRegions(world, regions);
+		SDL_UnlockMutex(world->mutex);
+
+		ReadRegions(&codec, world, regions, numRegions);
+
+		for (int i = 1; i < numRegions; i++)
+			FinishRegion(world, regions[i]);
+
+		// the batch already tried to read it
+		SDL_LockMutex(regions[0]->mutex);
+		GenerateMissingRegion(&codec, regions[0]);
+		SDL_UnlockMutex(regions[0]->mutex);
+		FinishRegion(world, regions[0]);
 	}
 
+	CodecContext_Free(&codec);
 	return 0;
 }
 
-// This finds/loads a chunk at a certain LOD level and places it in the active list. It also returns the chunk.
-static Chunk *LoadLodChunk(World *world, ivec3 coords, int lodLevel, int alignment)
+// Returns the active chunk with exactly these coords and LOD level, or NULL.
+static Chunk *FindActiveChunk(World *world, ivec3 coords, int lodLevel)
 {
-	ivec3 end;
-	glm_ivec3_adds(coords, alignment, end);
+	uint64_t value;
+	if (!HashMapUInt64Get(&world->chunkIndex, CoordsKey(coords, lodLevel), &value)) return NULL;
+	return (void *)value;
+}
 
-	ListUInt64 *chunkList = &(world->allChunks);
-	Chunk *foundChunk = NULL;
+static void AddActiveChunk(World *world, Chunk *chunk)
+{
+	// A chunk coming back into the active list may have different neighbors than when it was meshed.
+	if (EnumHasFlag(chunk->flags, CHUNK_MESHED)) World_MarkChunkDirty(world, chunk);
 
-	// Check if the chunk is already loaded and in the active list.
-	// Also remove previously loaded chunks at different LOD levels that overlap the desired chunk.
-	for (int i = 0; i < chunkList->size; i++)
+	chunk->activeIndex = world->allChunks.size;
+	ListUInt64Insert(&world->allChunks, (uint64_t)chunk);
+	HashMapUInt64Set(&world->chunkIndex, CoordsKey(chunk->coords, chunk->lodLevel), (uint64_t)chunk);
+	if (chunk->region != NULL) chunk->region->numActive++;
+}
+
+// Takes a chunk out of the active list and index. The last chunk in the list fills the gap.
+static void RemoveActiveChunk(World *world, Chunk *chunk)
+{
+	ListUInt64 *chunkList = &world->allChunks;
+	int i = chunk->activeIndex;
+	if (i < 0) return;
+
+	Chunk *last = (void *)ListUInt64Pop(chunkList);
+
+	if (last != chunk)
 	{
-		Chunk *c = (void *)chunkList->values[i];
-		ivec3 cEnd;
-		glm_ivec3_adds(c->coords, 1 << c->lodLevel, cEnd);
+		chunkList->values[i] = (uint64_t)last;
+		last->activeIndex = i;
+	}
+
+	chunk->activeIndex = -1;
+	HashMapUInt64Remove(&world->chunkIndex, CoordsKey(chunk->coords, chunk->lodLevel));
+	if (chunk->region != NULL) chunk->region->numActive--;
+
+	// inactive chunks aren't drawn, so their blocks don't need to stay on the GPU
+	if (chunk->drawBuffer != 0) ListUInt64Insert(&world->freedBuffers, chunk->drawBuffer);
+	chunk->drawBuffer = 0;
+}
+
+// Removes active chunks at other LOD levels that overlap the area of the given chunk coords.
+// Active chunks never overlap each other, so each coarser level has at most one candidate.
+static void RemoveOverlappingChunks(World *world, ivec3 coords, int lodLevel)
+{
+	int alignment = 1 << lodLevel;
+	ivec3 c;
+
+	for (int level = lodLevel + 1; level <= world->maxLodLevel; level++)
+	{
+		glm_ivec3_copy(coords, c);
+		Align(c, 1 << level);
+		Chunk *chunk = FindActiveChunk(world, c, level);
+		if (chunk != NULL) RemoveActiveChunk(world, chunk);
+	}
 
-		if (c->coords[0] < end[0] && cEnd[0] > coords[0] &&
-			c->coords[1] < end[1] && cEnd[1] > coords[1] &&
-			c->coords[2] < end[2] && cEnd[2] > coords[2])
+	// A coarse chunk covers more positions of the finest levels than there are active chunks, so then it's quicker
+	// to go through the active list.
+	if ((int64_t)alignment * alignment * alignment > (int64_t)world->allChunks.size)
+	{
+		// iterate backwards because removal moves the last chunk into the gap
+		for (int i = (int)world->allChunks.size - 1; i >= 0; i--)
 		{
-			if (c->lodLevel == lodLevel)
-			{
-				foundChunk = c;
-			}
-			else
+			Chunk *chunk = (void *)world->allChunks.values[i];
+
+			if (chunk->lodLevel < lodLevel &&
+				coords[0] <= chunk->coords[0] && chunk->coords[0] < coords[0] + alignment &&
+				coords[1] <= chunk->coords[1] && chunk->coords[1] < coords[1] + alignment &&
+				coords[2] <= chunk->coords[2] && chunk->coords[2] < coords[2] + alignment)
 			{
-				ListUInt64RemoveAt(&world->allChunks, i--);
-				//printf("Dead chunk.\n");
+				RemoveActiveChunk(world, chunk);
 			}
 		}
-	}
-
-	if (foundChunk != NULL) return foundChunk;
 
-	// TODO: For now, all region files cover the same width (eight L0 chunks).
-	const int w = 8;
-	ListUInt64 regionList = world->regions;
-	Region *region = NULL;
+		return;
+	}
 
-	// The desired chunk is not in the active list, but has its region been loaded into memory?
-	for (int i = 0; i < regionList.size; i++)
+	for (int level = 0; level < lodLevel; level++)
 	{
-		Region *r = (void *)regionList.values[i];
-		if (r->lodLevel != lodLevel) continue;
+		int levelAlignment = 1 << level;
 
-		if (r->baseCoords[0] < end[0] && (r->baseCoords[0] + w) > coords[0] &&
-			r->baseCoords[1] < end[1] && (r->baseCoords[1] + w) > coords[1] &&
-			r->baseCoords[2] < end[2] && (r->baseCoords[2] + w) > coords[2])
+		// finer levels: check every chunk position of that level inside the area
+		for (c[2] = coords[2]; c[2] < coords[2] + alignment; c[2] += levelAlignment)
 		{
-			region = r;
-			break;
+			for (c[1] = coords[1]; c[1] < coords[1] + alignment; c[1] += levelAlignment)
+			{
+				for (c[0] = coords[0]; c[0] < coords[0] + alignment; c[0] += levelAlignment)
+				{
+					Chunk *chunk = FindActiveChunk(world, c, level);
+					if (chunk != NULL) RemoveActiveChunk(world, chunk);
+				}
+			}
 		}
 	}
+}
 
-	// Construct the region if not found. Its block data will be loaded/generated on another thread.
-	if (region == NULL)
-	{
-		ivec3 baseCoords;
-		glm_ivec3_copy(coords, baseCoords);
-		int baseLodLevel = 3; // TODO: this is constant for now
-		Align(baseCoords, 1 << baseLodLevel);
-		region = ConstructRegion(world, baseCoords, lodLevel);
-		ListUInt64Insert(&(world->regions), (uint64_t)region);
-	}
+// Returns the region with these base coords and LOD level, constructing it if it isn't in memory.
+// The block data of a new region will be loaded/generated on another thread.
+static Region *GetRegion(World *world, ivec3 baseCoords, int lodLevel)
+{
+	uint64_t value;
+	uint64_t regionKey = CoordsKey(baseCoords, lodLevel);
+	if (HashMapUInt64Get(&world->regionIndex, regionKey, &value)) return (void *)value;
 
-	Chunk *newChunk = NULL;
-	int numChunks = NumChunksInRegion(lodLevel);
+	Region *region = ConstructRegion(world, baseCoords, lodLevel);
+
+	SDL_LockMutex(world->mutex);
+	world->memoryUsed += region->memorySize;
+	ListUInt64Insert(&(world->regions), (uint64_t)region);
+	HashMapUInt64Set(&world->regionIndex, regionKey, (uint64_t)region);
+	QueueRegion(world, region);
+	SDL_UnlockMutex(world->mutex);
+
+	return region;
+}
+
+// This finds/loads a chunk at a certain LOD level and places it in the active list. It also returns the chunk.
+static Chunk *LoadLodChunk(World *world, ivec3 coords, int lodLevel, int alignment)
+{
+	// Fast path: the chunk is already loaded and in the active list.
+	Chunk *foundChunk = FindActiveChunk(world, coords, lodLevel);
+	if (foundChunk != NULL) return foundChunk;
+
+	// Remove previously loaded chunks at different LOD levels that overlap the desired chunk.
+	RemoveOverlappingChunks(world, coords, lodLevel);
+
+	ivec3 baseCoords;
+	glm_ivec3_copy(coords, baseCoords);
+	Align(baseCoords, RegionWidth(lodLevel));
+
+	// The desired chunk is not in the active list, but its region may already be in memory.
+	Region *region = GetRegion(world, baseCoords, lodLevel);
 
 	// Now find the chunk within the region. It may or may not have its block data filled in yet, and that's fine.
-	for (int i = 0; i < numChunks; i++)
-	{
-		Chunk *c = region->chunks + i;
+	int m = ChunkIndexInRegion(baseCoords, coords, lodLevel);
+	Chunk *newChunk = NULL;
 
-		if (c->coords[0] == coords[0] &&
-			c->coords[1] == coords[1] &&
-			c->coords[2] == coords[2])
-		{
-			newChunk = c;
-			break;
-		}
-	}
+	if (m < region->numChunks) newChunk = region->chunks + m;
 
-	if (newChunk == NULL)
+	if (newChunk == NULL || newChunk->coords[0] != coords[0] || newChunk->coords[1] != coords[1] || newChunk->coords[2] != coords[2])
 	{
 		// this should not happen
 		printf("Chunk not found!\n");
@@ -407,26 +941,32 @@ static Chunk *LoadLodChunk(World *world, ivec3 coords, int lodLevel, int alignme
 		ConstructChunk(newChunk, world, coords, lodLevel);
 	}
 
-	// assuming the right chunk was found...
-	ListUInt64Insert(&(world->allChunks), (uint64_t)newChunk);
+	AddActiveChunk(world, newChunk);
 	world->dirty = true;
 	return newChunk;
 }
 
-// Loads a ring of chunks at a certain LOD level around the already loaded area.
-// This gets called with progressively higher LOD levels so that distant chunks are less detailed.
+// Fills in the area that a ring at a certain LOD level extends the loaded area to, aligned to the next coarser level.
 // The width of the ring is determined by world->lodDistance.
-static void LoadLodLevel(World *world, ivec3 loadedStart, ivec3 loadedEnd, int lodLevel)
+static void GetLodArea(World *world, ivec3 loadedStart, ivec3 loadedEnd, int lodLevel, ivec3 start, ivec3 end)
 {
 	int alignment = 1 << lodLevel;
 	int nextAlignment = alignment << 1;
 	int lDist = world->lodDistance * alignment;
-	ivec3 coords, start, end;
 	glm_ivec3_subs(loadedStart, lDist, start);
 	glm_ivec3_adds(loadedEnd, lDist - 1, end);
 	Align(start, nextAlignment);
 	Align(end, nextAlignment);
 	glm_ivec3_adds(end, nextAlignment, end);
+}
+
+// Loads a ring of chunks at a certain LOD level around the already loaded area.
+// This gets called with progressively higher LOD levels so that distant chunks are less detailed.
+static void LoadLodLevel(World *world, ivec3 loadedStart, ivec3 loadedEnd, int lodLevel)
+{
+	int alignment = 1 << lodLevel;
+	ivec3 coords, start, end;
+	GetLodArea(world, loadedStart, loadedEnd, lodLevel, start, end);
 
 	// find individual chunks within the target area and load them
 	for (coords[2] = start[2]; coords[2] < end[2]; coords[2] += alignment)
@@ -445,76 +985,457 @@ static void LoadLodLevel(World *world, ivec3 loadedStart, ivec3 loadedEnd, int l
 		}
 	}
 
-	/*
-	const int w = 8;
-	ListUInt64 regionList = world->regions;
-	ListUInt64 *chunkList = &(world->allChunks);
+	// mark the area as loaded
+	glm_ivec3_copy(start, loadedStart);
+	glm_ivec3_copy(end, loadedEnd);
+}
+
+// Removes active chunks that are outside the area loaded for their LOD level.
+static void DeactivateOutOfRange(World *world, ivec3 *areaStart, ivec3 *areaEnd, int maxLodLevel)
+{
+	ListUInt64 *chunkList = &world->allChunks;
 
-	// check for regions out of range and free them
-	for (int i = 0; i < regionList.size; i++)
+	// iterate backwards because removal moves the last chunk into the gap
+	for (int i = (int)chunkList->size - 1; i >= 0; i--)
 	{
-		Region *r = (void *)regionList.values[i];
-		if (r->lodLevel != lodLevel) continue;
+		Chunk *c = (void *)chunkList->values[i];
+		int level = c->lodLevel;
 
-		// Is the region outside the area we just loaded?
-		if (r->baseCoords[0] >= end[0] || (r->baseCoords[0] + w) < start[0] ||
-			r->baseCoords[1] >= end[1] || (r->baseCoords[1] + w) < start[1] ||
-			r->baseCoords[2] >= end[2] || (r->baseCoords[2] + w) < start[2])
+		if (level > maxLodLevel ||
+			c->coords[0] < areaStart[level][0] || c->coords[0] >= areaEnd[level][0] ||
+			c->coords[1] < areaStart[level][1] || c->coords[1] >= areaEnd[level][1] ||
+			c->coords[2] < areaStart[level][2] || c->coords[2] >= areaEnd[level][2])
 		{
-			int numChunks = NumChunksInRegion(r->lodLevel);
-			uint64_t firstChunkAddress = (uint64_t)r->chunks;
-			uint64_t lastChunkAddress = firstChunkAddress + ((numChunks - 1) * sizeof(Chunk));
+			RemoveActiveChunk(world, c);
+		}
+	}
+}
 
-			SDL_LockMutex(world->mutex);
-			for (int j = 0; j < chunkList->size; j++)
-			{
-				uint64_t chunkAddress = chunkList->values[j];
+// Takes a region out of the world so that it can be freed once no generation thread is using it.
+// Its edits are queued for writing right away, so a new copy of the region that is loaded before
+// this one is freed reads them from the writer's queue instead of the outdated archive.
+static void KillRegion(World *world, Region *region)
+{
+	SDL_LockMutex(world->mutex);
+	bool save = region->loaded && !region->loading && region->modified;
 
-				// Does the chunk belong to the region we're trying to remove?
-				if (firstChunkAddress <= chunkAddress && chunkAddress <= lastChunkAddress)
-				{
-					ListUInt64RemoveAt(&world->allChunks, j--);
-					printf("Removing chunk from dead region.\n");
-				}
-			}
+	for (int i = 0; i < world->regions.size; i++)
+	{
+		if (world->regions.values[i] == (uint64_t)region)
+		{
+			ListUInt64RemoveAt(&world->regions, i);
+			break;
+		}
+	}
 
-			// release memory
-			DestroyRegion(r);
-			SDL_UnlockMutex(world->mutex);
+	HashMapUInt64Remove(&world->regionIndex, CoordsKey(region->baseCoords, region->lodLevel));
+	UnqueueRegion(world, region);
+	region->dead = true;
+
+	for (int i = 0; i < region->numChunks; i++)
+		region->chunks[i].flags |= CHUNK_DEAD;
+
+	ListUInt64Insert(&world->deadRegions, (uint64_t)region);
+	world->memoryUsed -= region->memorySize;
+	SDL_UnlockMutex(world->mutex);
+
+	if (save)
+	{
+		SaveRegion(region, false);
+		region->modified = false;
+	}
+}
+
+// Kills regions that have no active chunks, farthest first, until memory use is within the budget.
+static void EvictRegions(World *world)
+{
+	if (world->memoryUsed <= world->memoryBudget) return;
+
+	ListUInt64 candidates;
+	ListUInt64Init(&candidates, 64);
+
+	for (int i = 0; i < world->regions.size; i++)
+	{
+		Region *r = (void *)world->regions.values[i];
+
+		// edits that haven't reached the coarser levels yet would be lost
+		if (r->numActive > 0 || r->numStale > 0 || r->numLodJobs > 0) continue;
+
+		// squared distance (in L0 chunks) from the region's center to the visible center
+		int64_t d = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			int64_t delta = r->baseCoords[a] + (RegionWidth(r->lodLevel) / 2) - world->visibleCenter[a];
+			d += delta * delta;
 		}
+
+		// pack the distance above the list index so that sorting orders candidates by distance
+		if (d > 0xffffffff) d = 0xffffffff;
+		ListUInt64Insert(&candidates, ((uint64_t)d << 32) | i);
 	}
-	*/
 
-	// mark the area as loaded
-	glm_ivec3_copy(start, loadedStart);
-	glm_ivec3_copy(end, loadedEnd);
+	qsort(candidates.values, candidates.size, sizeof(uint64_t), CompareUInt64);
+
+	// collect first, because killing regions reorders the region list
+	ListUInt64 victims;
+	ListUInt64Init(&victims, 64);
+	size_t projected = world->memoryUsed;
+
+	for (int i = (int)candidates.size - 1; i >= 0 && projected > world->memoryBudget; i--)
+	{
+		Region *r = (void *)world->regions.values[candidates.values[i] & 0xffffffff];
+		ListUInt64Insert(&victims, (uint64_t)r);
+		projected -= r->memorySize;
+	}
+
+	for (int i = 0; i < victims.size; i++)
+		KillRegion(world, (void *)victims.values[i]);
+
+	free(candidates.values);
+	free(victims.values);
+}
+
+// Writes back and frees dead regions, unless a generation or mesher thread is still using them.
+static void ReapDeadRegions(World *world)
+{
+	ListUInt64 *deadList = &world->deadRegions;
+
+	for (int i = (int)deadList->size - 1; i >= 0; i--)
+	{
+		Region *region = (void *)deadList->values[i];
+
+		// Dead regions are no longer queued or indexed, so nothing can claim or pin them after this.
+		SDL_LockMutex(world->mutex);
+		bool busy = region->loading || region->numReaders > 0;
+		SDL_UnlockMutex(world->mutex);
+
+		// A mesher thread may still be reading one of the chunks, either to mesh it or as a neighbor.
+		for (int j = 0; j < region->numChunks && !busy; j++)
+			busy = region->chunks[j].meshRefs > 0;
+
+		if (busy) continue;
+
+		deadList->values[i] = deadList->values[--deadList->size];
+
+		if (region->loaded && region->modified) SaveRegion(region, true);
+		DestroyRegion(region);
+	}
+}
+
+// Queues every loaded region that has edits, so they reach the disk even if the game doesn't exit cleanly.
+static void SaveModifiedRegions(World *world)
+{
+	for (int i = 0; i < world->regions.size; i++)
+	{
+		Region *region = (void *)world->regions.values[i];
+		if (!region->modified) continue;
+
+		// a generation thread may still be filling in the region
+		SDL_LockMutex(world->mutex);
+		bool busy = region->loading;
+		SDL_UnlockMutex(world->mutex);
+
+		if (!busy && region->loaded)
+		{
+			SaveRegion(region, false);
+			region->modified = false;
+		}
+	}
+
+	world->lastSaveTicks = SDL_GetTicks();
+}
+
+// Returns the chunk with these coords and LOD level if its region is in memory, or NULL. Main thread only.
+static Chunk *FindRegionChunk(World *world, ivec3 coords, int lodLevel)
+{
+	ivec3 baseCoords;
+	glm_ivec3_copy(coords, baseCoords);
+	Align(baseCoords, RegionWidth(lodLevel));
+
+	uint64_t value;
+	if (!HashMapUInt64Get(&world->regionIndex, CoordsKey(baseCoords, lodLevel), &value)) return NULL;
+
+	Region *region = (void *)value;
+	return region->chunks + ChunkIndexInRegion(baseCoords, coords, lodLevel);
+}
+
+// Remembers that a chunk changed since it was last condensed into the next coarser level. Main thread only.
+// Edits always reach the region level, whose regions cover the same area as the finer ones,
+// and the coarser levels only when the world is set up to load them.
+static void MarkLodStale(World *world, Chunk *chunk)
+{
+	int topLevel = world->maxLodLevel > REGION_LOD_LEVEL ? world->maxLodLevel : REGION_LOD_LEVEL;
+	if (chunk->region == NULL || chunk->lodLevel >= topLevel || EnumHasFlag(chunk->flags, CHUNK_LOD_STALE)) return;
+
+	chunk->flags |= CHUNK_LOD_STALE;
+	chunk->region->numStale++;
+	ListUInt64Insert(&world->staleChunks, (uint64_t)chunk);
+}
+
+// Queues LOD jobs for the coarser chunks of stale chunks, with the stale chunks copied. A coarser region that isn't
+// in memory is queued for loading, and its jobs wait until it is loaded. With a codec, such regions are loaded
+// right away on this thread instead, which is only safe once the generation threads are stopped.
+static void ScheduleLodUpdates(World *world, CodecContext *codec)
+{
+	ListUInt64 *staleList = &world->staleChunks;
+
+	for (int i = 0; i < staleList->size; i++)
+	{
+		Chunk *chunk = (void *)staleList->values[i];
+		if (!EnumHasFlag(chunk->flags, CHUNK_LOD_STALE)) continue; // taken along with an earlier chunk
+
+		// the coarser chunk covers this one and 7 others of the same level
+		int level = chunk->lodLevel;
+		ivec3 parentCoords, coarseBase;
+		glm_ivec3_copy(chunk->coords, parentCoords);
+		Align(parentCoords, 2 << level);
+		glm_ivec3_copy(parentCoords, coarseBase);
+		Align(coarseBase, RegionWidth(level + 1));
+		Region *coarse = GetRegion(world, coarseBase, level + 1);
+
+		SDL_LockMutex(world->mutex);
+		bool ready = coarse->loaded && !coarse->loading;
+
+		if (!ready && codec != NULL)
+		{
+			UnqueueRegion(world, coarse);
+			coarse->loading = true;
+		}
+
+		SDL_UnlockMutex(world->mutex);
+
+		if (!ready && codec != NULL)
+		{
+			LoadRegion(codec, coarse);
+			FinishRegion(world, coarse);
+			ready = true;
+		}
+
+		Chunk *target = coarse->chunks + ChunkIndexInRegion(coarseBase, parentCoords, level + 1);
+		if (!ready || EnumHasFlag(target->flags, CHUNK_LOD_UPDATING)) continue;
+
+		// Only the main thread changes the block data of loaded regions, so it can be copied without locking.
+		LodJob *job = calloc(1, sizeof(LodJob));
+		job->chunk = target;
+		Blocks_Copy(&job->result, &target->blocks);
+
+		// The other stale chunks with the same coarser chunk come along. Above the region level they are in other
+		// regions, which stay in memory while they have stale chunks.
+		for (int m = 0; m < 8; m++)
+		{
+			ivec3 c;
+			Coords_ApplyMortonOffset(parentCoords, m, level, c);
+			Chunk *sibling = FindRegionChunk(world, c, level);
+			if (sibling == NULL || !EnumHasFlag(sibling->flags, CHUNK_LOD_STALE)) continue;
+
+			Blocks_Copy(job->children + m, &sibling->blocks);
+			job->octants |= 1 << m;
+			sibling->flags &= ~CHUNK_LOD_STALE;
+			sibling->region->numStale--;
+		}
+
+		target->flags |= CHUNK_LOD_UPDATING;
+		coarse->numLodJobs++;
+
+		SDL_LockMutex(world->mutex);
+		ListUInt64Insert(&world->lodJobs, (uint64_t)job);
+		SDL_CondSignal(world->jobCond);
+		SDL_UnlockMutex(world->mutex);
+	}
+
+	// keep the chunks that are still waiting
+	int numStale = 0;
+
+	for (int i = 0; i < staleList->size; i++)
+	{
+		Chunk *chunk = (void *)staleList->values[i];
+		if (EnumHasFlag(chunk->flags, CHUNK_LOD_STALE)) staleList->values[numStale++] = (uint64_t)chunk;
+	}
+
+	staleList->size = numStale;
+	world->lastLodTicks = SDL_GetTicks();
+}
+
+// Swaps the results of finished LOD jobs into their chunks. A changed chunk becomes stale in turn,
+// so edits carry on up to the coarsest level. Main thread only.
+static void ApplyLodResults(World *world)
+{
+	while (true)
+	{
+		SDL_LockMutex(world->mutex);
+		LodJob *job = world->lodResults.size > 0 ? (void *)ListUInt64Pop(&world->lodResults) : NULL;
+		SDL_UnlockMutex(world->mutex);
+
+		if (job == NULL) break;
+
+		Chunk *chunk = job->chunk;
+		Region *region = chunk->region;
+
+		// mesher threads read the block data under the chunk mutex
+		SDL_LockMutex(chunk->mutex);
+		size_t oldSize = Blocks_MemorySize(&chunk->blocks);
+		Blocks_Free(&chunk->blocks);
+		chunk->blocks = job->result;
+		size_t newSize = Blocks_MemorySize(&chunk->blocks);
+		SDL_UnlockMutex(chunk->mutex);
+
+		SDL_LockMutex(world->mutex);
+		region->memorySize += newSize - oldSize;
+		world->memoryUsed += newSize - oldSize;
+		SDL_UnlockMutex(world->mutex);
+
+		chunk->flags &= ~CHUNK_LOD_UPDATING;
+		region->numLodJobs--;
+		region->modified = true;
+		World_MarkChunkDirty(world, chunk);
+		MarkLodStale(world, chunk);
+		free(job);
+	}
+}
+
+// Carries all edits up to the coarsest level before the world is saved for the last time.
+// The generation threads must be stopped, so the jobs run and the coarser regions load on this thread.
+static void FlushLodUpdates(World *world)
+{
+	CodecContext codec;
+	CodecContext_Init(&codec);
+	ApplyLodResults(world);
+
+	while (world->staleChunks.size > 0 || world->lodJobs.size > 0)
+	{
+		ScheduleLodUpdates(world, &codec);
+
+		while (world->lodJobs.size > 0)
+		{
+			LodJob *job = (void *)ListUInt64Pop(&world->lodJobs);
+			RunLodJob(job);
+			ListUInt64Insert(&world->lodResults, (uint64_t)job);
+		}
+
+		ApplyLodResults(world);
+	}
+
+	CodecContext_Free(&codec);
+}
+
+// Reads the optional settings file in the world folder. Each line is a key and a value, like "codec lz" or "io stdio".
+static void LoadSettings(World *world)
+{
+	world->regionCodec = CODEC_RLE_ZLIB;
+	world->readBackend = ReadBatch_UringSupported() ? READ_BACKEND_URING : READ_BACKEND_STDIO;
+	world->maxLodLevel = REGION_LOD_LEVEL;
+	world->lodDistance = 1;
+	world->memoryBudget = 1024ull * 1024 * 1024; // 1 GiB
+
+	char path[PATH_FULLMAXLEN];
+	Path_Combine(path, world->folderPath, "world.cfg");
+	FILE *file = fopen(path, "r");
+	if (file == NULL) return;
+
+	char key[32], value[32];
+
+	while (fscanf(file, "%31s %31s", key, value) == 2)
+	{
+		if (strcmp(key, "codec") == 0)
+		{
+			if (strcmp(value, "lz") == 0) world->regionCodec = CODEC_RLE_LZ;
+			else if (strcmp(value, "zlib") == 0) world->regionCodec = CODEC_RLE_ZLIB;
+			else printf("Unknown codec \"%s\" in %s.\n", value, path);
+		}
+		else if (strcmp(key, "io") == 0)
+		{
+			// io_uring stays off where the system doesn't support it
+			if (strcmp(value, "stdio") == 0) world->readBackend = READ_BACKEND_STDIO;
+			else if (strcmp(value, "uring") != 0) printf("Unknown I/O backend \"%s\" in %s.\n", value, path);
+		}
+		else if (strcmp(key, "lod_levels") == 0)
+		{
+			int levels = atoi(value);
+			if (levels >= 1 && levels <= LOD_MAX_LEVELS) world->maxLodLevel = levels - 1;
+			else printf("LOD levels must be from 1 to %d in %s.\n", LOD_MAX_LEVELS, path);
+		}
+		else if (strcmp(key, "lod_distance") == 0)
+		{
+			int distance = atoi(value);
+			if (distance >= 1) world->lodDistance = distance;
+			else printf("LOD distance must be at least 1 in %s.\n", path);
+		}
+		else if (strcmp(key, "memory_budget") == 0)
+		{
+			// in MiB
+			long long budget = atoll(value);
+			if (budget >= 1) world->memoryBudget = (size_t)budget * 1024 * 1024;
+			else printf("Memory budget must be at least 1 MiB in %s.\n", path);
+		}
+	}
+
+	fclose(file);
 }
 
 void World_Init(World* world)
 {
 	Uint32 ticks = SDL_GetTicks();
 
-	world->folderPath = "res/world/debug";
+	world->folderPath = WORLD_FOLDER_PATH;
+	LoadSettings(world);
+	world->archives = Archive_OpenSet(world->folderPath);
+	world->writer = RegionWriter_New(world->archives);
+	world->lastSaveTicks = SDL_GetTicks();
+	world->lastLodTicks = SDL_GetTicks();
 	world->mutex = SDL_CreateMutex();
-	world->visibleDistance = 3;
-	world->lodDistance = 1;
+	world->jobCond = SDL_CreateCond();
+	world->memoryUsed = 0;
 	world->alive = true;
 	world->dirty = true;
 	ListUInt64Init(&world->regions, 64);
 	ListUInt64Init(&world->allChunks, 64);
-	ListUInt64Init(&world->deadChunks, 64);
+	ListUInt64Init(&world->freedBuffers, 64);
+	ListUInt64Init(&world->deadRegions, 64);
+	ListUInt64Init(&world->jobQueue, 64);
+	ListUInt64Init(&world->staleChunks, 64);
+	ListUInt64Init(&world->lodJobs, 64);
+	ListUInt64Init(&world->lodResults, 64);
+	HashMapUInt64Init(&world->chunkIndex, 1024);
+	HashMapUInt64Init(&world->regionIndex, 256);
 
 	for (int i = 0; i < NUM_CHUNK_THREADS; i++)
 	{
 		SDL_Thread *thread = SDL_CreateThread(RegionGenThread, "World Generation Thread", world);
 		world->chunkGenThreads[i] = thread;
-		SDL_DetachThread(thread);
 	}
 
 	ticks = SDL_GetTicks() - ticks;
 	printf("World init took %d ms.\n", ticks);
 }
 
+// Stops the generation threads, waiting for them to finish the region they are working on,
+// then carries edits up to the coarser levels and writes every edited region to disk. The mesher must be destroyed first.
+void World_Destroy(World* world)
+{
+	SDL_LockMutex(world->mutex);
+	world->alive = false;
+	SDL_CondBroadcast(world->jobCond);
+	SDL_UnlockMutex(world->mutex);
+
+	for (int i = 0; i < NUM_CHUNK_THREADS; i++)
+		SDL_WaitThread(world->chunkGenThreads[i], NULL);
+
+	FlushLodUpdates(world);
+	SaveModifiedRegions(world);
+
+	// With every other thread stopped, dead regions can be saved even if a mesher left them pinned.
+	for (int i = 0; i < world->deadRegions.size; i++)
+	{
+		Region *region = (void *)world->deadRegions.values[i];
+		if (region->loaded && region->modified) SaveRegion(region, false);
+	}
+
+	RegionWriter_Destroy(world->writer);
+	world->writer = NULL;
+	Archive_CloseSet(world->archives);
+	world->archives = NULL;
+}
+
 void World_BlockToChunkCoords(ivec3 b, ivec3 c)
 {
 	c[0] = (b[0] - (b[0] < 0 ? 63 : 0)) / 64;
@@ -537,6 +1458,20 @@ Chunk* World_GetChunkAndCoords(World* world, ivec3 wPos, ivec3 cPos)
 	return LoadLodChunk(world, chunkCoords, 0, 1);
 }
 
+// Returns the active chunk with these chunk coords and LOD level, or NULL. Main thread only.
+Chunk* World_GetActiveChunk(World* world, ivec3 coords, int lodLevel)
+{
+	return FindActiveChunk(world, coords, lodLevel);
+}
+
+// Flags a chunk to be meshed again. Bumping the version also covers a mesh that is already in progress.
+void World_MarkChunkDirty(World* world, Chunk* chunk)
+{
+	chunk->version++;
+	chunk->flags |= CHUNK_DIRTY;
+	world->dirty = true;
+}
+
 uint8_t World_GetBlock(Chunk* chunk, ivec3 pos)
 {
 	int x = pos[0];
@@ -546,9 +1481,13 @@ uint8_t World_GetBlock(Chunk* chunk, ivec3 pos)
 	if (x < 0 || x > 63 || y < 0 || y > 63 || z < 0 || z > 63)
 		return 0;
 
+	// block data may still be in the works on a generation thread
+	if (!EnumHasFlag(chunk->flags, CHUNK_LOADED))
+		return BLOCK_AIR;
+
 	int m = GetMortonCode(x, y, z);
 
-	return chunk->blocks[m];
+	return Blocks_Get(&chunk->blocks, m);
 }
 
 bool World_IsSolidBlock(World* world, ivec3 pos)
@@ -564,17 +1503,60 @@ void World_SetBlock(World* world, ivec3 pos, uint8_t type)
 	ivec3 cPos;
 	Chunk* chunk = World_GetChunkAndCoords(world, pos, cPos);
 
-	if (chunk != NULL)
+	// Until the chunk is loaded, its block data belongs to a generation thread.
+	if (chunk != NULL && EnumHasFlag(chunk->flags, CHUNK_LOADED))
 	{
-		SetBlock(chunk, cPos[0], cPos[1], cPos[2], type);
-		chunk->flags |= CHUNK_DIRTY;
-		world->dirty = true;
+		// Mesher threads read the block data under the chunk mutex, and setting a block can reallocate it.
+		SDL_LockMutex(chunk->mutex);
+		size_t oldSize = Blocks_MemorySize(&chunk->blocks);
+		Blocks_Set(&chunk->blocks, GetMortonCode(cPos[0], cPos[1], cPos[2]), type);
+		size_t newSize = Blocks_MemorySize(&chunk->blocks);
+		SDL_UnlockMutex(chunk->mutex);
+
+		if (newSize != oldSize && chunk->region != NULL)
+		{
+			SDL_LockMutex(world->mutex);
+			chunk->region->memorySize += newSize - oldSize;
+			world->memoryUsed += newSize - oldSize;
+			SDL_UnlockMutex(world->mutex);
+		}
+
+		World_MarkChunkDirty(world, chunk);
+
+		// The mesher can patch the existing mesh when it knows exactly which blocks changed.
+		// If the log is full, the version no longer adds up and the chunk gets meshed from scratch.
+		if (chunk->numEdits < CHUNK_EDIT_LOG_SIZE)
+			chunk->edits[chunk->numEdits++] = cPos[0] | (cPos[1] << 6) | (cPos[2] << 12);
+
+		if (chunk->region != NULL) chunk->region->modified = true;
+
+		// the coarser levels catch up in the background
+		MarkLodStale(world, chunk);
+
+		// A block on the boundary can hide or expose faces of the neighboring chunk.
+		for (int a = 0; a < 3; a++)
+		{
+			if (cPos[a] != 0 && cPos[a] != 63) continue;
+
+			ivec3 n;
+			glm_ivec3_copy(chunk->coords, n);
+			n[a] += cPos[a] == 0 ? -1 : 1;
+
+			Chunk *neighbor = FindActiveChunk(world, n, 0);
+			if (neighbor == NULL)
+			{
+				Align(n, 2);
+				neighbor = FindActiveChunk(world, n, 1);
+			}
+
+			if (neighbor != NULL) World_MarkChunkDirty(world, neighbor);
+		}
 	}
 }
 
 void World_UpdatePosition(World *world, ivec3 globalCenterBlock)
 {
-	int maxLodLevel = world->visibleDistance;
+	int maxLodLevel = world->maxLodLevel;
 
 	ivec3 chunkCoords, loadedStart, loadedEnd;
 	World_BlockToChunkCoords(globalCenterBlock, chunkCoords);
@@ -586,7 +1568,10 @@ void World_UpdatePosition(World *world, ivec3 globalCenterBlock)
 		return;
 	}
 
+	SDL_LockMutex(world->mutex);
 	glm_ivec3_copy(chunkCoords, world->visibleCenter);
+	ReprioritizeQueue(world);
+	SDL_UnlockMutex(world->mutex);
 
 	// load the chunk at the center position at full detail (L0)
 	LoadLodChunk(world, chunkCoords, 0, 1);
@@ -594,8 +1579,41 @@ void World_UpdatePosition(World *world, ivec3 globalCenterBlock)
 	glm_ivec3_adds(chunkCoords, 1, loadedEnd);
 
 	// load an additional ring around the center at L0 and repeat for each LOD
+	ivec3 areaStart[maxLodLevel + 1];
+	ivec3 areaEnd[maxLodLevel + 1];
+
 	for (int level = 0; level <= maxLodLevel; level++)
 	{
 		LoadLodLevel(world, loadedStart, loadedEnd, level);
+		glm_ivec3_copy(loadedStart, areaStart[level]);
+		glm_ivec3_copy(loadedEnd, areaEnd[level]);
 	}
+
+	// whatever is left behind no longer needs to be active, and may be evicted
+	DeactivateOutOfRange(world, areaStart, areaEnd, maxLodLevel);
+	EvictRegions(world);
+}
+
+// Returns how far chunks can be from the camera, in blocks, which is twice the distance from the visible center
+// to the edge of the area loaded for the coarsest level, so that the corners of the area are covered too.
+int World_GetViewDistance(World *world)
+{
+	ivec3 start = { 0, 0, 0 };
+	ivec3 end = { 1, 1, 1 };
+
+	for (int level = 0; level <= world->maxLodLevel; level++)
+		GetLodArea(world, start, end, level, start, end);
+
+	int extent = -start[0] > end[0] ? -start[0] : end[0];
+	return extent * 64 * 2;
+}
+
+// Per-frame housekeeping: frees regions that were evicted once it is safe to do so, carries edits up to the
+// coarser levels, and saves edits now and then.
+void World_Update(World *world)
+{
+	ApplyLodResults(world);
+	if (world->staleChunks.size > 0 && SDL_GetTicks() - world->lastLodTicks >= LOD_UPDATE_INTERVAL) ScheduleLodUpdates(world, NULL);
+	if (world->deadRegions.size > 0) ReapDeadRegions(world);
+	if (SDL_GetTicks() - world->lastSaveTicks >= WORLD_SAVE_INTERVAL) SaveModifiedRegions(world);
 }
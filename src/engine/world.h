@@ -6,6 +6,7 @@
 #include "cglm/cglm.h"
 #include "noise.h"
 #include "utility.h"
+#include "blocks.h"
 
 typedef enum
 {
@@ -13,11 +14,23 @@ typedef enum
 	CHUNK_GENERATED = 1 << 1,
 	CHUNK_DIRTY = 1 << 2,
 	CHUNK_DEAD = 1 << 3,
+	CHUNK_MESHING = 1 << 4, // queued for or being meshed by a mesher thread
+	CHUNK_MESHED = 1 << 5, // quads are ready to draw, although they may be outdated
+	CHUNK_LOD_STALE = 1 << 6, // changed since it was last condensed into the next coarser level
+	CHUNK_LOD_UPDATING = 1 << 7, // changed finer chunks are being condensed into it
 } ChunkFlags;
 
+#define WORLD_FOLDER_PATH "res/world/debug"
+
 enum
 {
-	NUM_CHUNK_THREADS = 4
+	NUM_CHUNK_THREADS = 4,
+	CHUNK_EDIT_LOG_SIZE = 16, // block edits a chunk remembers between meshes
+	WORLD_SAVE_INTERVAL = 5000, // ms between saves of edited regions
+	REGION_READ_BATCH = 8, // regions a generation thread claims at once, to read their files together
+	REGION_LOD_LEVEL = 3, // regions of this level and finer ones are aligned to its chunks. Coarser regions hold one chunk.
+	LOD_MAX_LEVELS = 12, // the most LOD levels a world can load, which archives have room for
+	LOD_UPDATE_INTERVAL = 1000, // ms between carrying edits up to the coarser levels
 };
 
 struct Chunk;
@@ -26,21 +39,41 @@ typedef struct Chunk Chunk;
 struct Region;
 typedef struct Region Region;
 
+struct RegionWriter;
+struct ArchiveSet;
+
 typedef struct
 {
 	char* folderPath;
+	int regionCodec; // ChunkCodec for compressing region files, set by the world's settings file
+	int readBackend; // ReadBackend for region files, io_uring where available
+	struct RegionWriter* writer; // writes region files in the background
+	struct ArchiveSet* archives; // where region files are stored
+	Uint32 lastSaveTicks;
 	NoiseMaker noiseMaker;
 	SDL_mutex* mutex;
 	SDL_Thread* chunkGenThreads[NUM_CHUNK_THREADS];
-	ListUInt64 deadChunks;
+	SDL_cond* jobCond; // signaled when regions are queued or the world shuts down
+	ListUInt64 jobQueue; // binary heap of regions waiting to be loaded, nearest first
+	ListUInt64 deadRegions; // evicted regions waiting to be written back and freed
+	ListUInt64 staleChunks; // chunks flagged CHUNK_LOD_STALE. Main thread only.
+	ListUInt64 lodJobs; // coarser chunks waiting for a generation thread to condense their changed finer chunks
+	ListUInt64 lodResults; // finished LOD jobs, for the main thread to swap in
+	Uint32 lastLodTicks;
 	bool alive;
 	bool dirty;
 
+	size_t memoryBudget; // bytes of region memory to keep before evicting unused regions
+	size_t memoryUsed;
+
 	ivec3 visibleCenter;
-	int visibleDistance;
-	int lodDistance;
+	int maxLodLevel; // the coarsest level that is loaded, set by the world's settings file
+	int lodDistance; // width of the ring each level adds around the finer ones, in chunks of that level
 	ListUInt64 allChunks;
+	ListUInt64 freedBuffers; // drawBuffers of chunks that left the active list, for the renderer to delete. Main thread only.
 	ListUInt64 regions;
+	HashMapUInt64 chunkIndex; // active chunks by coords and LOD level
+	HashMapUInt64 regionIndex; // regions by base coords and LOD level
 } World;
 
 struct Chunk
@@ -48,12 +81,19 @@ struct Chunk
 	World* world;
 	SDL_mutex* mutex;
 	ivec3 coords;
-	uint64_t* occupancy;
-	uint64_t* faceMasks;
 	ListUInt64 quads;
 	ChunkFlags flags;
+	unsigned int version; // incremented on every block edit
 	int lodLevel;
-	uint8_t blocks[64 * 64 * 64]; // 256 kiB
+	int activeIndex; // position in world->allChunks, or -1 if not active
+	int meshRefs; // mesher jobs reading this chunk, which keep its region from being freed
+	int8_t neighborLods[6]; // LOD level of each side's neighbor when last meshed, or -1 if none was loaded
+	int numEdits; // blocks set since the chunk was last queued for meshing, up to CHUNK_EDIT_LOG_SIZE
+	uint32_t edits[CHUNK_EDIT_LOG_SIZE]; // positions of those blocks, packed as x | y << 6 | z << 12
+	Region *region;
+	BlockStorage blocks; // written by generation threads until the chunk is loaded, then only by the main thread
+	unsigned int drawBuffer; // GL buffer the renderer keeps the blocks in while the chunk is active, or 0
+	unsigned int drawVersion; // version of the blocks in drawBuffer
 };
 
 struct Region
@@ -62,15 +102,43 @@ struct Region
 	ivec3 baseCoords;
 	int lodLevel;
 	int numChunks;
+	int numActive; // number of its chunks in world->allChunks
+	int queueIndex; // position in world->jobQueue, or -1 if not queued
+	uint64_t priority; // lower values are loaded first
+	bool loading; // claimed by a generation thread
 	bool loaded;
+	bool dead; // killed by EvictRegions. Only read or written under world->mutex.
+	bool modified; // has edits that are not on disk yet. Main thread only.
+	int numStale; // chunks flagged CHUNK_LOD_STALE. Main thread only.
+	int numLodJobs; // LOD jobs that will write into its chunks. Main thread only.
+	int numReaders; // generation threads condensing its chunks for a coarser region, which keep it from being freed
+	size_t memorySize; // bytes counted in world->memoryUsed, including block data
 	Chunk *chunks;
 	World *world;
 };
 
+// Regions are aligned to L3 chunks, so finer regions hold more chunks.
+static inline int NumChunksInRegion(int lodLevel)
+{
+	if (lodLevel >= REGION_LOD_LEVEL) return 1;
+	return 1 << (3 * (REGION_LOD_LEVEL - lodLevel));
+}
+
+// Width of a region in L0 chunks, which its base coords are aligned to.
+static inline int RegionWidth(int lodLevel)
+{
+	return 1 << (lodLevel > REGION_LOD_LEVEL ? lodLevel : REGION_LOD_LEVEL);
+}
+
 void World_Init(World* world);
+void World_Destroy(World* world);
 void World_BlockToChunkCoords(ivec3 b, ivec3 c);
 Chunk* World_GetChunkAndCoords(World* world, ivec3 wPos, ivec3 cPos);
+Chunk* World_GetActiveChunk(World* world, ivec3 coords, int lodLevel);
+void World_MarkChunkDirty(World* world, Chunk* chunk);
 uint8_t World_GetBlock(Chunk* chunk, ivec3 pos);
 bool World_IsSolidBlock(World* world, ivec3 pos);
 void World_SetBlock(World* world, ivec3 pos, uint8_t type);
 void World_UpdatePosition(World *world, ivec3 globalCenterBlock);
+int World_GetViewDistance(World *world);
+void World_Update(World *world);
@@ -0,0 +1,228 @@
+// Writes region files in the background, so that generation threads and the main thread never wait for the disk.
+//
+// Saves are queued as snapshots of block data. A region that is saved again before its last snapshot was written
+// only keeps the newest one. Each batch is encoded here, with the chunks of each region spread over several threads,
+// and stored in the archives with one round of syncs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "SDL2/SDL.h"
+#include "writer.h"
+#include "compress.h"
+#include "utility.h"
+
+enum
+{
+	WRITER_QUEUE_SIZE = 16, // regions waiting to be written before saving blocks
+};
+
+typedef struct
+{
+	ivec3 baseCoords;
+	int lodLevel;
+	int codec;
+	int numChunks;
+	BlockStorage *blocks; // owned snapshot of every chunk
+} WriteJob;
+
+struct RegionWriter
+{
+	SDL_mutex *mutex;
+	SDL_cond *jobCond; // signaled when jobs are queued or the writer shuts down
+	SDL_cond *spaceCond; // signaled when a batch is done
+	SDL_Thread *thread;
+	RegionEncoder *encoder; // only used by the writer thread
+	ArchiveSet *archives;
+	ListUInt64 jobs; // WriteJob pointers, oldest first; the first numWriting are being written
+	int numWriting;
+	bool alive;
+};
+
+static void FreeJob(WriteJob *job)
+{
+	for (int i = 0; i < job->numChunks; i++)
+		Blocks_Free(job->blocks + i);
+
+	free(job->blocks);
+	free(job);
+}
+
+static bool IsJobFor(const WriteJob *job, ivec3 baseCoords, int lodLevel)
+{
+	return job->lodLevel == lodLevel && job->baseCoords[0] == baseCoords[0]
+		&& job->baseCoords[1] == baseCoords[1] && job->baseCoords[2] == baseCoords[2];
+}
+
+// Encodes a batch of regions and stores them in their archives.
+static void WriteBatch(RegionWriter *writer, WriteJob **jobs, int numJobs)
+{
+	ArchiveWrite writes[numJobs];
+
+	for (int i = 0; i < numJobs; i++)
+	{
+		glm_ivec3_copy(jobs[i]->baseCoords, writes[i].baseCoords);
+		writes[i].lodLevel = jobs[i]->lodLevel;
+		writes[i].data = RegionEncoder_Encode(writer->encoder, jobs[i]->lodLevel, jobs[i]->blocks, jobs[i]->numChunks, jobs[i]->codec, &writes[i].size);
+	}
+
+	Archive_WriteRegions(writer->archives, writes, numJobs);
+
+	for (int i = 0; i < numJobs; i++)
+	{
+		if (!writes[i].success)
+		{
+			int *c = jobs[i]->baseCoords;
+			printf("Error writing region (%d, %d, %d) L%d.\n", c[0], c[1], c[2], jobs[i]->lodLevel);
+		}
+
+		free((void *)writes[i].data);
+	}
+}
+
+// Writes queued regions in batches until the writer shuts down and the queue is empty.
+// This runs in a dedicated thread.
+static int WriterThread(void *threadData)
+{
+	RegionWriter *writer = threadData;
+
+	while (true)
+	{
+		SDL_LockMutex(writer->mutex);
+
+		while (writer->alive && writer->jobs.size == 0)
+			SDL_CondWait(writer->jobCond, writer->mutex);
+
+		if (writer->jobs.size == 0)
+		{
+			SDL_UnlockMutex(writer->mutex);
+			break;
+		}
+
+		// The batch stays in the queue while it's written, so loads can still find it,
+		// but newer saves of the same regions are queued separately from now on.
+		int numJobs = writer->jobs.size;
+		WriteJob *batch[numJobs];
+		memcpy(batch, writer->jobs.values, numJobs * sizeof(WriteJob *));
+		writer->numWriting = numJobs;
+		SDL_UnlockMutex(writer->mutex);
+
+		WriteBatch(writer, batch, numJobs);
+
+		SDL_LockMutex(writer->mutex);
+		for (int i = 0; i < numJobs; i++)
+			ListUInt64RemoveAt(&writer->jobs, 0);
+
+		writer->numWriting = 0;
+		SDL_CondBroadcast(writer->spaceCond);
+		SDL_UnlockMutex(writer->mutex);
+
+		for (int i = 0; i < numJobs; i++)
+			FreeJob(batch[i]);
+	}
+
+	return 0;
+}
+
+RegionWriter *RegionWriter_New(ArchiveSet *archives)
+{
+	RegionWriter *writer = calloc(1, sizeof(RegionWriter));
+	if (writer == NULL) return NULL;
+
+	writer->mutex = SDL_CreateMutex();
+	writer->jobCond = SDL_CreateCond();
+	writer->spaceCond = SDL_CreateCond();
+	writer->encoder = RegionEncoder_New(SDL_GetCPUCount());
+	writer->archives = archives;
+	writer->alive = true;
+	ListUInt64Init(&writer->jobs, WRITER_QUEUE_SIZE);
+	writer->thread = SDL_CreateThread(WriterThread, "Region Writer Thread", writer);
+
+	return writer;
+}
+
+// Writes everything that is still queued and stops the writer thread.
+void RegionWriter_Destroy(RegionWriter *writer)
+{
+	if (writer == NULL) return;
+
+	SDL_LockMutex(writer->mutex);
+	writer->alive = false;
+	SDL_CondBroadcast(writer->jobCond);
+	SDL_UnlockMutex(writer->mutex);
+
+	SDL_WaitThread(writer->thread, NULL);
+	RegionEncoder_Destroy(writer->encoder);
+
+	free(writer->jobs.values);
+	SDL_DestroyCond(writer->jobCond);
+	SDL_DestroyCond(writer->spaceCond);
+	SDL_DestroyMutex(writer->mutex);
+	free(writer);
+}
+
+// Queues a region to be written to its archive. The writer takes ownership of blocks, which holds numChunks chunks.
+// This only waits if the queue is full.
+void RegionWriter_Save(RegionWriter *writer, ivec3 baseCoords, int lodLevel, int codec, BlockStorage *blocks, int numChunks)
+{
+	SDL_LockMutex(writer->mutex);
+
+	// a region that is still waiting only needs its newest snapshot
+	for (int i = writer->numWriting; i < writer->jobs.size; i++)
+	{
+		WriteJob *job = (void *)writer->jobs.values[i];
+		if (!IsJobFor(job, baseCoords, lodLevel)) continue;
+
+		BlockStorage *oldBlocks = job->blocks;
+		job->blocks = blocks;
+		job->codec = codec;
+		SDL_UnlockMutex(writer->mutex);
+
+		for (int j = 0; j < numChunks; j++)
+			Blocks_Free(oldBlocks + j);
+
+		free(oldBlocks);
+		return;
+	}
+
+	while (writer->jobs.size - writer->numWriting >= WRITER_QUEUE_SIZE)
+		SDL_CondWait(writer->spaceCond, writer->mutex);
+
+	WriteJob *job = malloc(sizeof(WriteJob));
+	glm_ivec3_copy(baseCoords, job->baseCoords);
+	job->lodLevel = lodLevel;
+	job->codec = codec;
+	job->numChunks = numChunks;
+	job->blocks = blocks;
+
+	ListUInt64Insert(&writer->jobs, (uint64_t)job);
+	SDL_CondSignal(writer->jobCond);
+	SDL_UnlockMutex(writer->mutex);
+}
+
+// Loads a region from its newest snapshot that is not on disk yet, since the archive may still be outdated.
+// Returns false if nothing is pending for the region.
+bool RegionWriter_ReadPending(RegionWriter *writer, Region *region)
+{
+	SDL_LockMutex(writer->mutex);
+
+	for (int i = (int)writer->jobs.size - 1; i >= 0; i--)
+	{
+		WriteJob *job = (void *)writer->jobs.values[i];
+		if (!IsJobFor(job, region->baseCoords, region->lodLevel)) continue;
+
+		for (int j = 0; j < region->numChunks; j++)
+		{
+			Blocks_Copy(&region->chunks[j].blocks, job->blocks + j);
+			region->chunks[j].flags |= CHUNK_LOADED | CHUNK_GENERATED;
+		}
+
+		SDL_UnlockMutex(writer->mutex);
+		region->loaded = true;
+		return true;
+	}
+
+	SDL_UnlockMutex(writer->mutex);
+	return false;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include "world.h"
+#include "blocks.h"
+#include "archive.h"
+
+struct RegionWriter;
+typedef struct RegionWriter RegionWriter;
+
+RegionWriter *RegionWriter_New(ArchiveSet *archives);
+void RegionWriter_Destroy(RegionWriter *writer);
+void RegionWriter_Save(RegionWriter *writer, ivec3 baseCoords, int lodLevel, int codec, BlockStorage *blocks, int numChunks);
+bool RegionWriter_ReadPending(RegionWriter *writer, Region *region);
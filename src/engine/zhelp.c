@@ -2,12 +2,12 @@
 // Original: https://www.zlib.net/zlib_how.html
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "zhelp.h"
 #include "zlib.h"
 
-#define CHUNK 65536 // zlib buffer size, not related to voxels
-
 static inline z_stream StreamInit()
 {
 	z_stream strm;
@@ -21,115 +21,115 @@ static inline z_stream StreamInit()
 	return strm;
 }
 
-// Compresses bytes with zlib and writes to a file.
+// Setting up a deflate stream allocates about 256 KB, which costs more than deflating a small chunk,
+// so each stream is only set up the first time it is needed and reset after that.
+struct ZContext
+{
+	z_stream deflater;
+	z_stream inflater;
+	bool deflaterReady;
+	bool inflaterReady;
+};
+
+ZContext *Z_NewContext(void)
+{
+	ZContext *ctx = calloc(1, sizeof(ZContext));
+	if (ctx == NULL) return NULL;
+
+	ctx->deflater = StreamInit();
+	ctx->inflater = StreamInit();
+	return ctx;
+}
+
+void Z_FreeContext(ZContext *ctx)
+{
+	if (ctx == NULL) return;
+	if (ctx->deflaterReady) (void)deflateEnd(&ctx->deflater);
+	if (ctx->inflaterReady) (void)inflateEnd(&ctx->inflater);
+	free(ctx);
+}
+
+// Compresses bytes with zlib into a buffer.
 // Sets the integer pointed to by compressedSize equal to the number of compressed bytes.
-// Returns Z_OK or a zlib error code.
-int Z_Deflate(uint8_t *source, int size, FILE *dest, int *compressedSize)
+// Returns Z_OK, Z_BUF_ERROR if the result doesn't fit in destSize bytes, or another zlib error code.
+int Z_Deflate(ZContext *ctx, const uint8_t *source, int size, uint8_t *dest, int destSize, int *compressedSize)
 {
 	const int level = Z_DEFAULT_COMPRESSION;
-	int ret, flush;
-	uint8_t out[CHUNK];
-	z_stream strm = StreamInit();
+	z_stream *strm = &ctx->deflater;
+	int ret;
 	*compressedSize = 0;
 
-	ret = deflateInit(&strm, level);
+	if (ctx->deflaterReady)
+	{
+		ret = deflateReset(strm);
+	}
+	else
+	{
+		ret = deflateInit(strm, level);
+		ctx->deflaterReady = ret == Z_OK;
+	}
+
 	if (ret != Z_OK) return ret;
 
-	do {
-		if (size - strm.total_in < CHUNK)
-		{
-			// tell zlib that this is the last/only batch of data
-			strm.avail_in = size - strm.total_in;
-			flush = Z_FINISH;
-		}
-		else
-		{
-			// give zlib a full input buffer and tell it that there may be more to come
-			strm.avail_in = CHUNK;
-			flush = Z_NO_FLUSH;
-		}
-
-		// input buffer starts at this pointer
-		strm.next_in = source + strm.total_in;
-
-		// Deflate until an error occurs, input is used up, or stream is finished, hence the second loop.
-		do {
-			strm.avail_out = CHUNK;
-			strm.next_out = out;
-			ret = deflate(&strm, flush);
-
-			if (ret == Z_OK || ret == Z_STREAM_END)
-			{
-				// write output to disk
-				int numCompressed = CHUNK - strm.avail_out;
-				int numWritten = fwrite(out, 1, numCompressed, dest);
-				if (numWritten != numCompressed || ferror(dest)) ret = Z_ERRNO;
-			}
-
-			// continue as long as progress is made, as indicated by Z_OK
-		} while (ret == Z_OK);
-
-		// all input should be used up
-		if (strm.avail_in != 0) ret = Z_DATA_ERROR;
-
-		// Z_BUF_ERROR means zlib needs more input. Continue until some other error or Z_STREAM_END.
-	} while (ret == Z_BUF_ERROR);
+	// the whole input is available, so it is deflated in one call
+	strm->next_in = (uint8_t *)source;
+	strm->avail_in = size;
+	strm->next_out = dest;
+	strm->avail_out = destSize;
+	ret = deflate(strm, Z_FINISH);
 
 	if (ret == Z_STREAM_END)
 	{
 		ret = Z_OK;
-		*compressedSize = strm.total_out;
+		*compressedSize = strm->total_out;
+	}
+	else if (ret == Z_OK)
+	{
+		// ran out of output space before the end of the stream
+		ret = Z_BUF_ERROR;
 	}
-
-	(void)deflateEnd(&strm);
 
 	return ret;
 }
 
-// Decompresses a file with zlib, filling in the destination buffer.
-// Sets the integer pointed to by size equal to the number of decompressed bytes.
+// Decompresses a zlib stream that is entirely in memory, filling in the destination buffer.
+// Sets the integer pointed to by size equal to the number of decompressed bytes, which never exceeds destSize.
 // Returns Z_OK or a zlib error code.
-int Z_Inflate(FILE *source, int compressedSize, uint8_t *dest, int *size)
+int Z_Inflate(ZContext *ctx, const uint8_t *source, int compressedSize, uint8_t *dest, int destSize, int *size)
 {
+	z_stream *strm = &ctx->inflater;
 	int ret;
-	uint8_t in[CHUNK];
-	z_stream strm = StreamInit();
 	*size = 0;
 
-	ret = inflateInit(&strm);
-	if (ret != Z_OK) return ret;
-
-	do {
-		int sizeToRead = compressedSize - strm.total_in;
-		if (sizeToRead > CHUNK) sizeToRead = CHUNK;
-
-		strm.avail_in = fread(in, 1, sizeToRead, source);
-
-		if (ferror(source)) { ret = Z_ERRNO; break; }
-		if (strm.avail_in == 0 || strm.avail_in != sizeToRead) { ret = Z_DATA_ERROR; break; }
-
-		strm.next_in = in;
-
-		// Inflate until an error occurs, input is used up, or stream is finished, hence the second loop.
-		do {
-			strm.avail_out = CHUNK;
-			strm.next_out = dest + strm.total_out;
-			ret = inflate(&strm, Z_NO_FLUSH);
-		} while (ret == Z_OK);
+	if (ctx->inflaterReady)
+	{
+		ret = inflateReset(strm);
+	}
+	else
+	{
+		ret = inflateInit(strm);
+		ctx->inflaterReady = ret == Z_OK;
+	}
 
-		// all input should be used up
-		//if (strm.avail_in != 0) ret = Z_DATA_ERROR;
+	if (ret != Z_OK) return ret;
 
-		// Z_BUF_ERROR means zlib needs more input. Continue until some other error or Z_STREAM_END.
-	} while (ret == Z_BUF_ERROR);
+	// the whole stream is available, so it is inflated in one call
+	strm->next_in = (uint8_t *)source;
+	strm->avail_in = compressedSize;
+	strm->next_out = dest;
+	strm->avail_out = destSize;
+	ret = inflate(strm, Z_FINISH);
 
 	if (ret == Z_STREAM_END)
 	{
 		ret = Z_OK;
-		*size = strm.total_out;
+		*size = strm->total_out;
+	}
+	else if (ret == Z_OK || ret == Z_BUF_ERROR)
+	{
+		// ran out of input or output before the end of the stream
+		ret = Z_DATA_ERROR;
 	}
-
-	(void)inflateEnd(&strm);
 
 	return ret;
 }
@@ -1,7 +1,12 @@
 #pragma once
 
-#include <stdio.h>
 #include <stdint.h>
 
-int Z_Deflate(uint8_t *source, int size, FILE *dest, int *compressedSize);
-int Z_Inflate(FILE *source, int compressedSize, uint8_t *dest, int *size);
+// zlib streams that are set up once and reset for each chunk. A context must only be used by one thread at a time.
+struct ZContext;
+typedef struct ZContext ZContext;
+
+ZContext *Z_NewContext(void);
+void Z_FreeContext(ZContext *ctx);
+int Z_Deflate(ZContext *ctx, const uint8_t *source, int size, uint8_t *dest, int destSize, int *compressedSize);
+int Z_Inflate(ZContext *ctx, const uint8_t *source, int compressedSize, uint8_t *dest, int destSize, int *size);
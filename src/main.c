@@ -3,6 +3,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_timer.h"
@@ -10,9 +11,71 @@
 #include "engine/game.h"
 #include "engine/render.h"
 #include "engine/input.h"
+#include "engine/compress.h"
+#include "engine/archive.h"
+#include "engine/noise.h"
+#include "engine/rle.h"
+#include "engine/lod.h"
+#include "engine/mesher.h"
 
 int main(int argc, char* argv[])
 {
+	// "--migrate [folder]" packs the region files of a world into archives and upgrades them to the current format instead of starting the game
+	if (argc > 1 && strcmp(argv[1], "--migrate") == 0)
+	{
+		Region_MigrateFolder(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--pack [folder]" moves the region files of a world from a directory per L3 region into archives
+	if (argc > 1 && strcmp(argv[1], "--pack") == 0)
+	{
+		Archive_ConvertFolder(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--benchmark-codecs [folder]" compares the region codecs on the saved chunks of a world
+	if (argc > 1 && strcmp(argv[1], "--benchmark-codecs") == 0)
+	{
+		Region_BenchmarkCodecs(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--benchmark-rle [folder]" checks the fast RLE encoder and decoder against the scalar ones and times both
+	if (argc > 1 && strcmp(argv[1], "--benchmark-rle") == 0)
+	{
+		Rle_Benchmark(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--benchmark-lod [folder]" checks the LOD downsampler against the original one and times both
+	if (argc > 1 && strcmp(argv[1], "--benchmark-lod") == 0)
+	{
+		Lod_Benchmark(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--benchmark-mesh [folder]" checks the greedy mesher against the original one and times both
+	if (argc > 1 && strcmp(argv[1], "--benchmark-mesh") == 0)
+	{
+		Mesher_Benchmark(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
+	// "--benchmark-noise" checks the vector terrain noise against the scalar one and times both, and the original
+	if (argc > 1 && strcmp(argv[1], "--benchmark-noise") == 0)
+	{
+		Noise_Benchmark();
+		return 0;
+	}
+
+	// "--benchmark-load [folder]" times loading the archived regions of a world from a cold cache with each I/O backend
+	if (argc > 1 && strcmp(argv[1], "--benchmark-load") == 0)
+	{
+		Region_BenchmarkLoad(argc > 2 ? argv[2] : WORLD_FOLDER_PATH);
+		return 0;
+	}
+
 	GameState *gs = Game_New();
 
 	if (gs == NULL)